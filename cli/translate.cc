@@ -4,6 +4,7 @@
 
 #include <boost/program_options.hpp>
 
+#include <ctranslate2/autotune.h>
 #include <ctranslate2/translator_pool.h>
 #include <ctranslate2/utils.h>
 #include <ctranslate2/devices.h>
@@ -44,6 +45,12 @@ int main(int argc, char* argv[]) {
      "Maximum number of translations to run in parallel.")
     ("intra_threads", po::value<size_t>()->default_value(0),
      "Number of OpenMP threads (set to 0 to use the default value).")
+    ("autotune", po::bool_switch()->default_value(false),
+     "Select inter_threads, intra_threads and batch_size by translating synthetic batches "
+     "at startup. The cores to split are inter_threads * intra_threads, or all cores if "
+     "intra_threads is 0.")
+    ("autotune_max_latency", po::value<size_t>()->default_value(0),
+     "Maximum batch latency in milliseconds of the autotuned configuration (0 for no limit).")
     ("device", po::value<std::string>()->default_value("cpu"),
      "Device to use (can be cpu, cuda, auto).")
     ("device_index", po::value<int>()->default_value(0),
@@ -72,8 +79,6 @@ int main(int argc, char* argv[]) {
     vm["device_index"].as<int>(),
     vm["compute_type"].as<std::string>());
 
-  ctranslate2::TranslatorPool translator_pool(inter_threads, intra_threads, model);
-
   auto options = ctranslate2::TranslationOptions();
   options.beam_size = vm["beam_size"].as<size_t>();
   options.length_penalty = vm["length_penalty"].as<float>();
@@ -81,6 +86,27 @@ int main(int argc, char* argv[]) {
   options.min_decoding_length = vm["min_sent_length"].as<size_t>();
   options.num_hypotheses = vm["n_best"].as<size_t>();
   options.use_vmap = vm["use_vmap"].as<bool>();
+  options.return_scores = vm["with_score"].as<bool>();
+
+  size_t batch_size = vm["batch_size"].as<size_t>();
+  if (vm["autotune"].as<bool>()) {
+    ctranslate2::AutotuneOptions autotune_options;
+    autotune_options.num_cores = inter_threads * intra_threads;
+    autotune_options.max_batch_latency = std::chrono::milliseconds(
+      vm["autotune_max_latency"].as<size_t>());
+    autotune_options.translation_options = options;
+    auto best = ctranslate2::autotune_threads(model, autotune_options).best;
+    inter_threads = best.inter_threads;
+    intra_threads = best.intra_threads;
+    batch_size = best.batch_size;
+    std::cerr << "Autotuned configuration: inter_threads=" << inter_threads
+              << " intra_threads=" << intra_threads
+              << " batch_size=" << batch_size
+              << " (" << best.tokens_per_second << " tokens/s, "
+              << best.batch_latency.count() << " ms per batch)" << std::endl;
+  }
+
+  ctranslate2::TranslatorPool translator_pool(inter_threads, intra_threads, model);
 
   std::istream* in = &std::cin;
   std::ostream* out = &std::cout;
@@ -98,7 +124,7 @@ int main(int argc, char* argv[]) {
   auto t1 = std::chrono::high_resolution_clock::now();
   auto num_tokens = translator_pool.consume_text_file(*in,
                                                       *out,
-                                                      vm["batch_size"].as<size_t>(),
+                                                      batch_size,
                                                       options,
                                                       vm["with_score"].as<bool>());
   auto t2 = std::chrono::high_resolution_clock::now();
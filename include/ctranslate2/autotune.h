@@ -0,0 +1,50 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "translator.h"
+
+namespace ctranslate2 {
+
+  struct AutotuneOptions {
+    // Number of cores to distribute between the replicas (0 for all cores).
+    size_t num_cores = 0;
+    // Batch sizes to try.
+    std::vector<size_t> batch_sizes = {8, 16, 32};
+    // Length of the synthetic source sentences.
+    size_t sentence_length = 20;
+    // Number of batches translated by each replica for each configuration, after
+    // a warmup batch.
+    size_t num_batches_per_replica = 2;
+    // Maximum time to translate a batch (0 for no limit).
+    std::chrono::milliseconds max_batch_latency{0};
+    // Options of the synthetic translations. The decoding length is forced to
+    // sentence_length so that all configurations generate the same number of tokens.
+    TranslationOptions translation_options;
+  };
+
+  struct ThreadsConfig {
+    size_t inter_threads = 1;
+    size_t intra_threads = 0;
+    size_t batch_size = 1;
+    // Measured performance of this configuration.
+    double tokens_per_second = 0;
+    std::chrono::milliseconds batch_latency{0};
+  };
+
+  struct AutotuneResult {
+    // Configuration with the highest throughput among the configurations within the
+    // latency target, or the configuration with the lowest latency if none is.
+    ThreadsConfig best;
+    std::vector<ThreadsConfig> configs;
+  };
+
+  // Translates synthetic batches with a TranslatorPool for several (inter_threads,
+  // intra_threads, batch_size) combinations that use all cores, and returns the
+  // configuration with the best throughput. This should be run on an idle CPU.
+  AutotuneResult autotune_threads(const std::shared_ptr<models::Model>& model,
+                                  const AutotuneOptions& options = AutotuneOptions());
+
+}
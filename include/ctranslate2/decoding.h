@@ -1,9 +1,19 @@
 #pragma once
 
+#include <functional>
+
 #include "ctranslate2/layers/decoder.h"
 
 namespace ctranslate2 {
 
+  // If should_stop is set, it is called before each decoding step and the search
+  // stops when it returns true. The returned hypotheses are then incomplete.
+  //
+  // If callback is set, it is called with (batch_id, token_id) for each token of the
+  // best hypothesis as soon as it is final. In beam search, a token is final when all
+  // hypotheses that can still be returned share it.
+  using TokenCallback = std::function<void(size_t, size_t)>;
+
   void greedy_search(layers::Decoder& decoder,
                      layers::DecoderState& state,
                      StorageView& sample_from,
@@ -16,7 +26,10 @@ namespace ctranslate2 {
                      size_t min_length,
                      std::vector<std::vector<std::vector<size_t>>>& sampled_ids,
                      std::vector<std::vector<float>>& scores,
-                     std::vector<std::vector<std::vector<std::vector<float>>>>* attention = nullptr);
+                     std::vector<std::vector<std::vector<std::vector<float>>>>* attention = nullptr,
+                     bool return_scores = true,
+                     const std::function<bool()>& should_stop = nullptr,
+                     const TokenCallback& callback = nullptr);
 
   void beam_search(layers::Decoder& decoder,
                    layers::DecoderState& state,
@@ -33,6 +46,8 @@ namespace ctranslate2 {
                    float length_penalty,
                    std::vector<std::vector<std::vector<size_t>>>& sampled_ids,
                    std::vector<std::vector<float>>& scores,
-                   std::vector<std::vector<std::vector<std::vector<float>>>>* attention = nullptr);
+                   std::vector<std::vector<std::vector<std::vector<float>>>>* attention = nullptr,
+                   const std::function<bool()>& should_stop = nullptr,
+                   const TokenCallback& callback = nullptr);
 
 }
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "layers/decoder.h"
+
+namespace ctranslate2 {
+
+  // Thread-safe LRU cache of the encoder output and of the decoder states that only
+  // depend on it (e.g. the encoder-attention keys and values), keyed by the source
+  // batch. Entries are copied in and out of the cache so they are never modified.
+  class EncoderCache {
+  public:
+    EncoderCache(size_t max_memory_bytes);
+
+    // Returns false if the source is not cached. Otherwise, fills the encoder output
+    // and the cached decoder states.
+    bool get(const std::vector<std::vector<std::string>>& source,
+             StorageView& encoded,
+             layers::DecoderState& state);
+    void put(const std::vector<std::vector<std::string>>& source,
+             const StorageView& encoded,
+             layers::DecoderState state);
+
+    size_t hits() const;
+    size_t misses() const;
+
+  private:
+    struct Entry {
+      std::string key;
+      StorageView encoded;
+      layers::DecoderState state;
+      size_t memory_usage;
+    };
+
+    std::mutex _mutex;
+    std::list<Entry> _entries;  // From the most to the least recently used.
+    std::unordered_map<std::string, std::list<Entry>::iterator> _index;
+    const size_t _max_memory;
+    size_t _memory_usage = 0;
+    std::atomic<size_t> _hits{0};
+    std::atomic<size_t> _misses{0};
+  };
+
+}
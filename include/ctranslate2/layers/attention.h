@@ -17,6 +17,9 @@ namespace ctranslate2 {
                       float queries_scale = 1);
     };
 
+    // Queries can also be a 2D [total_time, depth] tensor of packed sequences (i.e.
+    // without padding) for self-attention. In this case, memory_lengths defines the
+    // length of each packed sequence.
     class MultiHeadAttention
     {
     public:
@@ -28,6 +31,8 @@ namespace ctranslate2 {
                       StorageView* cached_keys = nullptr,
                       StorageView* cached_values = nullptr,
                       StorageView* attention = nullptr);
+      // Computes the keys and values of the memory, as cached by operator().
+      void compute_memory_proj(const StorageView& memory, StorageView& keys, StorageView& values);
     private:
       size_t _num_heads;
       std::vector<Dense> _linear;
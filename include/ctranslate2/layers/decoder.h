@@ -18,6 +18,16 @@ namespace ctranslate2 {
 
       virtual void reduce_vocab(const StorageView&) {}
       virtual DecoderState initial_state() const = 0;
+      // Returns true if the state is shared by all entries of the same memory batch
+      // (see below), in which case it should not be expanded or reordered per beam.
+      virtual bool is_shared_state(const std::string&) const {
+        return false;
+      }
+      // Computes the shared states from the memory. Otherwise they are computed on the
+      // first decoding step.
+      virtual void compute_memory_state(const StorageView&, DecoderState&) {}
+      // The memory batch size can be a divisor of the ids batch size: consecutive ids
+      // batches are then attending the same memory, e.g. the beams of a sentence.
       virtual void operator()(size_t step,
                               const StorageView& ids,
                               const StorageView& memory,
@@ -45,6 +45,10 @@ namespace ctranslate2 {
       virtual std::unique_ptr<layers::Encoder> make_encoder() const = 0;
       virtual std::unique_ptr<layers::Decoder> make_decoder() const = 0;
 
+      // Returns a deep copy of this model. The weights are allocated and written by the
+      // calling thread so they are placed on its NUMA node.
+      virtual std::shared_ptr<Model> clone() const = 0;
+
     protected:
       Model(const std::string& path, size_t spec_revision);
 
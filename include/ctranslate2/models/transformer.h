@@ -16,6 +16,7 @@ namespace ctranslate2 {
       size_t current_spec_revision() const override;
       std::unique_ptr<layers::Encoder> make_encoder() const override;
       std::unique_ptr<layers::Decoder> make_decoder() const override;
+      std::shared_ptr<Model> clone() const override;
     protected:
       TransformerModel(const std::string& path, size_t spec_revision, size_t num_heads);
       void register_variable(const std::string& name, StorageView& variable) override;
@@ -38,6 +39,8 @@ namespace ctranslate2 {
     public:
       PositionEncoder(const TransformerModel& model, const std::string& scope);
       void operator()(StorageView& input, size_t index = 0);
+      // Adds position encodings to packed sequences [total_time, depth].
+      void operator()(StorageView& input, const StorageView& lengths);
     private:
       const StorageView& get_position_encoding(size_t max_time, size_t depth, Device device) const;
       const StorageView* _encoding;
@@ -79,6 +82,9 @@ namespace ctranslate2 {
                       StorageView& cached_attn_values,
                       StorageView& output,
                       StorageView* attention = nullptr);
+      void compute_memory_state(const StorageView& memory,
+                                StorageView& cached_attn_keys,
+                                StorageView& cached_attn_values);
     private:
       layers::MultiHeadAttention _self_attention;
       layers::MultiHeadAttention _encoder_attention;
@@ -105,6 +111,9 @@ namespace ctranslate2 {
       TransformerDecoder(const TransformerModel& model, const std::string& scope);
       void reduce_vocab(const StorageView& ids) override;
       layers::DecoderState initial_state() const override;
+      bool is_shared_state(const std::string& name) const override;
+      void compute_memory_state(const StorageView& memory,
+                                layers::DecoderState& state) override;
       void operator()(size_t step,
                       const StorageView& ids,
                       const StorageView& memory,
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "op.h"
+
+namespace ctranslate2 {
+  namespace ops {
+
+    // Fused scaled dot product attention: softmax(alpha * Q.K^T, lengths).V
+    //
+    // Keys are processed by blocks with a streaming softmax so that the
+    // [batch, heads, queries_time, keys_time] scores matrix is never materialized.
+    //
+    // Inputs are either 4D tensors [batch, heads, time, depth] or 3D tensors
+    // [heads, total_time, depth] of packed sequences (i.e. without padding) for
+    // self-attention. In the packed case, values_lengths is required and defines
+    // the length of each sequence.
+    class DotProductAttention : public Op {
+    public:
+      DotProductAttention(float queries_scale = 1)
+        : _queries_scale(queries_scale) {
+      }
+
+      void operator()(const std::vector<StorageView*>& inputs,
+                      std::vector<StorageView*>& outputs) const override {
+        operator()(*inputs[0], *inputs[1], *inputs[2], inputs[3], *outputs[0]);
+      }
+
+      void operator()(const StorageView& queries,
+                      const StorageView& keys,
+                      const StorageView& values,
+                      const StorageView* values_lengths,
+                      StorageView& output) const {
+        if (queries.device() != Device::CPU)
+          throw std::invalid_argument("DotProductAttention is only supported on CPU");
+        if (queries.rank() == 3) {
+          if (!values_lengths)
+            throw std::invalid_argument("DotProductAttention requires lengths for packed inputs");
+          output.resize({queries.dim(0), queries.dim(1), values.dim(2)});
+        } else if (queries.rank() == 4) {
+          output.resize({queries.dim(0), queries.dim(1), queries.dim(2), values.dim(3)});
+        } else {
+          throw std::invalid_argument("DotProductAttention expects 3D or 4D inputs");
+        }
+        compute<Device::CPU, float>(queries, keys, values, values_lengths, output);
+      }
+
+    private:
+      float _queries_scale;
+
+      template <Device D, typename T>
+      void compute(const StorageView& queries,
+                   const StorageView& keys,
+                   const StorageView& values,
+                   const StorageView* values_lengths,
+                   StorageView& output) const;
+    };
+
+  }
+}
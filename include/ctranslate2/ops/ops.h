@@ -3,6 +3,7 @@
 // Operators following ONNX specifications.
 
 #include "add.h"
+#include "attention.h"
 #include "concat.h"
 #include "cos.h"
 #include "gather.h"
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+namespace ctranslate2 {
+
+  // Sets the number of threads used by parallel_for when called from the current
+  // thread, including the current thread. The threads are created on first use and
+  // are reused by the next calls.
+  void set_parallel_num_threads(size_t num_threads);
+  size_t get_parallel_num_threads();
+
+  // Pins the thread i > 0 used by parallel_for in the current thread to cpus[i]. The
+  // thread 0 is the current thread, which keeps its affinity.
+  void set_parallel_affinity(const std::vector<std::vector<size_t>>& cpus);
+
+  // Runs task(i) for i in [0, num_tasks) on the threads of the current thread. Tasks
+  // that call parallel_for run their loop inline and MKL functions called by the
+  // tasks run single-threaded.
+  void run_parallel_tasks(size_t num_tasks, const std::function<void(size_t)>& task);
+
+  // Minimum number of elements that are processed by a parallel task. Smaller loops
+  // are not worth the synchronization cost and run in the calling thread.
+  static const size_t min_elements_per_task = 32768;
+
+  // Returns the grain size of a loop where each iteration processes
+  // elements_per_iteration elements.
+  inline size_t grain_size_for(size_t elements_per_iteration) {
+    return std::max(min_elements_per_task / std::max(elements_per_iteration, size_t(1)),
+                    size_t(1));
+  }
+
+  // Calls func(chunk_begin, chunk_end) on chunks of [begin, end) with at least
+  // grain_size iterations. The loop runs inline when there is a single chunk.
+  template <typename Function>
+  void parallel_for(size_t begin, size_t end, size_t grain_size, const Function& func) {
+    if (begin >= end)
+      return;
+    const size_t size = end - begin;
+    grain_size = std::max(grain_size, size_t(1));
+    const size_t max_chunks = (size + grain_size - 1) / grain_size;
+    const size_t num_chunks = std::min(max_chunks, get_parallel_num_threads());
+    if (num_chunks <= 1) {
+      func(begin, end);
+      return;
+    }
+
+    const size_t chunk_size = (size + num_chunks - 1) / num_chunks;
+    run_parallel_tasks(num_chunks, [&](size_t chunk) {
+      const size_t chunk_begin = begin + chunk * chunk_size;
+      const size_t chunk_end = std::min(chunk_begin + chunk_size, end);
+      if (chunk_begin < chunk_end)
+        func(chunk_begin, chunk_end);
+    });
+  }
+
+}
@@ -5,6 +5,8 @@
 #include <functional>
 #include <numeric>
 
+#include "ctranslate2/parallel.h"
+
 #include "primitives_decl.h"
 
 namespace ctranslate2 {
@@ -168,11 +170,12 @@ namespace ctranslate2 {
   void primitives<Device::CPU>::unquantize_batch(const T* x, const float* scale, float* y,
                                                  size_t x_size, size_t scale_size) {
     size_t depth = x_size / scale_size;
-    #pragma omp parallel for
-    for (size_t i = 0; i < scale_size; ++i) {
-      const auto offset = i * depth;
-      unquantize(x + offset, y + offset, depth, scale[i]);
-    }
+    parallel_for(0, scale_size, grain_size_for(depth), [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        const auto offset = i * depth;
+        unquantize(x + offset, y + offset, depth, scale[i]);
+      }
+    });
   }
 
   template<>
@@ -186,12 +189,13 @@ namespace ctranslate2 {
   template<>
   template <typename DataType, typename IndexType>
   void primitives<Device::CPU>::transpose_2d(const DataType* a, const IndexType* dims, DataType* b) {
-    #pragma omp parallel for
-    for (size_t i0 = 0; i0 < dims[0]; ++i0) {
-      for (size_t i1 = 0; i1 < dims[1]; ++i1) {
-        b[i1 * dims[0] + i0] = a[i0 * dims[1] + i1];
+    parallel_for(0, dims[0], grain_size_for(dims[1]), [&](size_t begin, size_t end) {
+      for (size_t i0 = begin; i0 < end; ++i0) {
+        for (size_t i1 = 0; i1 < dims[1]; ++i1) {
+          b[i1 * dims[0] + i0] = a[i0 * dims[1] + i1];
+        }
       }
-    }
+    });
   }
 
   template<>
@@ -208,18 +212,19 @@ namespace ctranslate2 {
     size_t perm_b_stride[3] = {b_stride[perm_ind[0]], b_stride[perm_ind[1]],
                                b_stride[perm_ind[2]]};
 
-    #pragma omp parallel for
-    for (size_t i0 = 0; i0 < dims[0]; ++i0) {
-      for (size_t i1 = 0; i1 < dims[1]; ++i1) {
-        for (size_t i2 = 0; i2 < dims[2]; ++i2) {
-          const size_t b_i = (i0 * perm_b_stride[0] + i1 * perm_b_stride[1] +
-                              i2 * perm_b_stride[2]);
-          const size_t a_i = (i0 * a_stride[0] + i1 * a_stride[1] +
-                              i2 * a_stride[2]);
-          b[b_i] = a[a_i];
+    parallel_for(0, dims[0], grain_size_for(dims[1] * dims[2]), [&](size_t begin, size_t end) {
+      for (size_t i0 = begin; i0 < end; ++i0) {
+        for (size_t i1 = 0; i1 < dims[1]; ++i1) {
+          for (size_t i2 = 0; i2 < dims[2]; ++i2) {
+            const size_t b_i = (i0 * perm_b_stride[0] + i1 * perm_b_stride[1] +
+                                i2 * perm_b_stride[2]);
+            const size_t a_i = (i0 * a_stride[0] + i1 * a_stride[1] +
+                                i2 * a_stride[2]);
+            b[b_i] = a[a_i];
+          }
         }
       }
-    }
+    });
   }
 
   template<>
@@ -237,20 +242,21 @@ namespace ctranslate2 {
     size_t perm_b_stride[4] = {b_stride[perm_ind[0]], b_stride[perm_ind[1]],
                                b_stride[perm_ind[2]], b_stride[perm_ind[3]]};
 
-    #pragma omp parallel for
-    for (size_t i0 = 0; i0 < dims[0]; ++i0) {
-      for (size_t i1 = 0; i1 < dims[1]; ++i1) {
-        for (size_t i2 = 0; i2 < dims[2]; ++i2) {
-          for (size_t i3 = 0; i3 < dims[3]; ++i3) {
-            const size_t b_i = (i0 * perm_b_stride[0] + i1 * perm_b_stride[1] +
-                                i2 * perm_b_stride[2] + i3 * perm_b_stride[3]);
-            const size_t a_i = (i0 * a_stride[0] + i1 * a_stride[1] +
-                                i2 * a_stride[2] + i3 * a_stride[3]);
-            b[b_i] = a[a_i];
+    parallel_for(0, dims[0], grain_size_for(dims[1] * dims[2] * dims[3]), [&](size_t begin, size_t end) {
+      for (size_t i0 = begin; i0 < end; ++i0) {
+        for (size_t i1 = 0; i1 < dims[1]; ++i1) {
+          for (size_t i2 = 0; i2 < dims[2]; ++i2) {
+            for (size_t i3 = 0; i3 < dims[3]; ++i3) {
+              const size_t b_i = (i0 * perm_b_stride[0] + i1 * perm_b_stride[1] +
+                                  i2 * perm_b_stride[2] + i3 * perm_b_stride[3]);
+              const size_t a_i = (i0 * a_stride[0] + i1 * a_stride[1] +
+                                  i2 * a_stride[2] + i3 * a_stride[3]);
+              b[b_i] = a[a_i];
+            }
           }
         }
       }
-    }
+    });
   }
 
   template<>
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "translator.h"
+
+namespace ctranslate2 {
+
+  // Thread-safe LRU cache of translation results. The entries are spread over
+  // several shards, each with its own lock and memory budget.
+  class TranslationCache {
+  public:
+    TranslationCache(size_t max_memory_bytes, size_t num_shards = 16);
+
+    // The key identifies an example and all options that change its translation.
+    static std::string make_key(const std::vector<std::string>& source,
+                                const std::vector<std::string>& target_prefix,
+                                const TranslationOptions& options);
+
+    // Returns nullptr if the key is not cached.
+    std::shared_ptr<const TranslationResult> get(const std::string& key);
+    void put(const std::string& key, const TranslationResult& result);
+
+    size_t hits() const;
+    size_t misses() const;
+    size_t memory_usage() const;
+
+  private:
+    using Entry = std::pair<std::string, std::shared_ptr<const TranslationResult>>;
+
+    struct Shard {
+      mutable std::mutex mutex;
+      std::list<Entry> entries;  // From the most to the least recently used.
+      std::unordered_map<std::string, std::list<Entry>::iterator> index;
+      size_t memory_usage = 0;
+    };
+
+    Shard& get_shard(const std::string& key);
+
+    std::vector<Shard> _shards;
+    const size_t _max_shard_memory;
+    std::atomic<size_t> _hits{0};
+    std::atomic<size_t> _misses{0};
+  };
+
+}
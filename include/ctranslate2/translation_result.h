@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <string>
 #include <vector>
 
@@ -27,4 +28,24 @@ namespace ctranslate2 {
     std::vector<std::vector<std::vector<float>>> _attention;
   };
 
+  // Results of a batch translated by token ids, stored in flat buffers. The hypotheses
+  // of all examples are stored one after the other: hypothesis k has the token ids
+  // ids[offsets[k], offsets[k + 1]) and the score scores[k], and the hypotheses of the
+  // example b are the hypotheses [hypotheses_offsets[b], hypotheses_offsets[b + 1]).
+  struct TranslationIdsResult {
+    std::vector<size_t> ids;
+    std::vector<size_t> offsets;
+    std::vector<float> scores;
+    std::vector<size_t> hypotheses_offsets;
+    // If attention is returned, the attention vectors of the hypothesis k are the rows
+    // [offsets[k], offsets[k + 1]) of a matrix with attention_size columns (the
+    // maximum source length of the batch).
+    std::vector<float> attention;
+    size_t attention_size = 0;
+
+    size_t batch_size() const {
+      return hypotheses_offsets.empty() ? 0 : hypotheses_offsets.size() - 1;
+    }
+  };
+
 }
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <functional>
 #include <string>
 #include <vector>
 
+#include "encoder_cache.h"
 #include "models/model.h"
 #include "translation_result.h"
 
@@ -16,6 +18,40 @@ namespace ctranslate2 {
     float length_penalty = 0;
     bool use_vmap = false;
     bool return_attention = false;
+    // Greedy search can skip the computation of the scores (they are then set to 0).
+    // This option is ignored by beam search.
+    bool return_scores = true;
+    // If set, this function is called with (batch_id, token) for each generated token
+    // of the best hypothesis as soon as it is final (see decoding.h).
+    std::function<void(size_t, const std::string&)> callback;
+  };
+
+  // Beam search always computes the scores, so return_scores only changes the greedy
+  // search output.
+  inline bool skip_scores(const TranslationOptions& options) {
+    return !options.return_scores && options.beam_size == 1;
+  }
+
+  // State kept between calls to Translator::translate_with_prefix: when the same source
+  // is translated again with a target prefix that extends the previous one, only the
+  // new prefix tokens are forwarded in the decoder.
+  class TranslationSession {
+  private:
+    friend class Translator;
+    std::vector<std::string> _source;
+    std::vector<std::string> _target_prefix;
+    StorageView _encoded;
+    StorageView _lengths;
+    layers::DecoderState _state;  // After forwarding _target_prefix.
+  };
+
+  // Encoder outputs of a batch, see Translator::encode_batch.
+  struct EncodedBatch {
+    std::vector<std::vector<std::string>> source;
+    StorageView encoded;
+    StorageView lengths;
+    // Decoder states that only depend on the encoder outputs.
+    layers::DecoderState memory_state;
   };
 
   // This class holds all information required to translate from a model. Copying
@@ -36,23 +72,95 @@ namespace ctranslate2 {
     translate_with_prefix(const std::vector<std::string>& source,
                           const std::vector<std::string>& target_prefix,
                           const TranslationOptions& options);
+    TranslationResult
+    translate_with_prefix(const std::vector<std::string>& source,
+                          const std::vector<std::string>& target_prefix,
+                          const TranslationOptions& options,
+                          TranslationSession& session);
 
     std::vector<TranslationResult>
     translate_batch(const std::vector<std::vector<std::string>>& tokens);
     std::vector<TranslationResult>
     translate_batch(const std::vector<std::vector<std::string>>& tokens,
                     const TranslationOptions& options);
+    // If should_stop is set, it is called before each decoding step and the translation
+    // stops early when it returns true (e.g. when the job was cancelled). The results
+    // are then incomplete.
     std::vector<TranslationResult>
     translate_batch_with_prefix(const std::vector<std::vector<std::string>>& source,
                                 const std::vector<std::vector<std::string>>& target_prefix,
-                                const TranslationOptions& options);
+                                const TranslationOptions& options,
+                                const std::function<bool()>& should_stop = nullptr);
+
+    // Translation by token ids, which skips the vocabulary lookups of the source and
+    // target tokens. Target prefixes are not supported and the encoder cache is not
+    // used. Token ids should be lower than the size of the source vocabulary.
+    TranslationIdsResult
+    translate_batch_ids(const std::vector<std::vector<size_t>>& source,
+                        const TranslationOptions& options = TranslationOptions(),
+                        const std::function<bool()>& should_stop = nullptr);
+
+    // Translation in two stages that can run on different translators of the same
+    // model: encode_batch runs the encoder and the decoder layers that only depend on
+    // its outputs, and translate_encoded_batch runs the decoding.
+    EncodedBatch encode_batch(const std::vector<std::vector<std::string>>& source);
+    std::vector<TranslationResult>
+    translate_encoded_batch(EncodedBatch batch,
+                            const std::vector<std::vector<std::string>>& target_prefix,
+                            const TranslationOptions& options,
+                            const std::function<bool()>& should_stop = nullptr);
 
     Device device() const;
+    const models::Model& model() const;
+
+    // Reuse the encoder outputs of previously translated sources (e.g. when the same
+    // source is translated with different target prefixes). The cache can be shared
+    // by multiple translators. Copies of this translator share the same cache.
+    void set_encoder_cache(const std::shared_ptr<EncoderCache>& cache);
 
   private:
     void make_graph();
+    void check_options(const TranslationOptions& options) const;
+    void check_inputs(const std::vector<std::vector<std::string>>& source,
+                      const std::vector<std::vector<std::string>>& target_prefix,
+                      const TranslationOptions& options) const;
+    void encode(const std::vector<std::vector<std::string>>& source,
+                StorageView& encoded,
+                StorageView& lengths,
+                layers::DecoderState& state,
+                bool with_memory_state);
+    StorageView make_candidates(const std::vector<std::vector<std::string>>& source,
+                                const TranslationOptions& options) const;
+    void search(const TranslationOptions& options,
+                const StorageView& encoded,
+                const StorageView& lengths,
+                layers::DecoderState& state,
+                StorageView& sample_from,
+                StorageView& candidates,
+                size_t start_step,
+                const std::function<bool()>& should_stop,
+                std::vector<std::vector<std::vector<size_t>>>& sampled_ids,
+                std::vector<std::vector<float>>& scores,
+                std::vector<std::vector<std::vector<std::vector<float>>>>* attention);
+    std::vector<TranslationResult>
+    decode(const std::vector<std::vector<std::string>>& source,
+           const std::vector<std::vector<std::string>>& target_prefix,
+           const TranslationOptions& options,
+           const StorageView& encoded,
+           const StorageView& lengths,
+           layers::DecoderState& state,
+           size_t num_forwarded_tokens,
+           const std::function<bool()>& should_stop,
+           TranslationSession* session);
+    std::vector<TranslationResult>
+    run_translation(const std::vector<std::vector<std::string>>& source,
+                    const std::vector<std::vector<std::string>>& target_prefix,
+                    const TranslationOptions& options,
+                    const std::function<bool()>& should_stop,
+                    TranslationSession* session);
 
     const std::shared_ptr<models::Model> _model;
+    std::shared_ptr<EncoderCache> _encoder_cache;
     std::unique_ptr<layers::Encoder> _encoder;
     std::unique_ptr<layers::Decoder> _decoder;
   };
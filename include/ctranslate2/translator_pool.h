@@ -1,12 +1,21 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
 #include <future>
 #include <istream>
+#include <memory>
 #include <mutex>
 #include <ostream>
 #include <queue>
 #include <thread>
 
+#include "translation_cache.h"
 #include "translator.h"
 
 namespace ctranslate2 {
@@ -14,73 +23,378 @@ namespace ctranslate2 {
   using TranslationInput = std::vector<std::vector<std::string>>;
   using TranslationOutput = std::vector<TranslationResult>;
 
+  // Queued jobs are served from the highest priority class first.
+  enum class JobPriority {
+    High,
+    Normal,
+    Low,  // Should remain the last value.
+  };
+
+  // Number of priority classes, i.e. of job queues in the pool.
+  static const size_t num_job_priorities = static_cast<size_t>(JobPriority::Low) + 1;
+
+  struct JobOptions {
+    JobPriority priority = JobPriority::Normal;
+    // Jobs that are still queued after this time point are failed without being run.
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+  };
+
+  // Called once when a job completes, with either an error or the job output.
+  using TranslationCallback = std::function<void(std::exception_ptr error,
+                                                 TranslationOutput output)>;
+  // Runs a completion callback, e.g. by posting it to an event loop.
+  using CallbackExecutor = std::function<void(std::function<void()>)>;
+
+  class TranslatorPool;
+
+  // Handle to a job posted with TranslatorPool::post_cancellable.
+  class TranslationJobHandle {
+  public:
+    std::future<TranslationOutput>& future() {
+      return _future;
+    }
+
+    // Removes the job from the queue or, if it is already running, stops the decoding
+    // at the next step. The future then throws a std::runtime_error. The pool must
+    // still be alive when this method is called.
+    void cancel();
+
+  private:
+    friend class TranslatorPool;
+    TranslationJobHandle(TranslatorPool& pool,
+                         std::shared_ptr<std::atomic<bool>> cancelled,
+                         std::future<TranslationOutput> future);
+
+    TranslatorPool& _pool;
+    std::shared_ptr<std::atomic<bool>> _cancelled;
+    std::future<TranslationOutput> _future;
+  };
+
+  // Options to merge jobs that are queued at the same time into a single batch.
+  // Only jobs without target prefix and with the same translation options are merged.
+  struct BatchingOptions {
+    // Maximum number of examples in a merged batch (0 disables merging).
+    size_t max_batch_size = 0;
+    // Maximum number of source tokens in a merged batch (0 for no limit).
+    size_t max_batch_tokens = 0;
+    // Maximum time a worker waits for more jobs when the batch is not full.
+    std::chrono::microseconds max_wait{0};
+  };
+
+  // Options to run the encoder and the decoder in separate workers: encoder workers
+  // encode the next batches while the pool workers decode the previous ones.
+  struct PipelineOptions {
+    // Number of encoder workers (0 disables the pipeline).
+    size_t num_encoder_workers = 0;
+    // 0 means the number of threads of each replica or, if it is also 0, an equal share
+    // of the cores between the replicas and the encoder workers.
+    size_t num_threads_per_encoder = 0;
+    // Maximum number of encoded batches waiting for a decoder worker. The encoder
+    // workers block when this limit is reached.
+    size_t max_queued_batches = 2;
+  };
+
+  // Options to place the CPU replicas on the cores and NUMA nodes of the host.
+  struct PlacementOptions {
+    // Assign the replicas to the NUMA nodes in a round-robin fashion and pin each
+    // worker and its OpenMP threads to the CPUs of its node.
+    bool numa_aware = false;
+    // Give each replica its own set of num_threads_per_replica physical cores, taken
+    // node by node. The worker is restricted to the union of these cores and each
+    // other thread of its team is pinned to one of them (SMT siblings are not shared
+    // between replicas). When enabled, the node of a replica is the node of its
+    // cores. Core sets wrap around if there are not enough cores.
+    bool pin_threads = false;
+    // Also keep one copy of the model weights per NUMA node so that replicas only
+    // read local memory. This multiplies the model memory by the number of nodes.
+    bool replicate_weights = false;
+  };
+
   // A pool of Translators running in parallel.
   class TranslatorPool {
   public:
     // "args" are forwarded to the Translator constructor.
     template <typename... Args>
-    TranslatorPool(size_t num_replicas, size_t num_threads_per_replica, Args&&... args) {
+    TranslatorPool(size_t num_replicas, size_t num_threads_per_replica, Args&&... args)
+      : TranslatorPool(PlacementOptions(),
+                       num_replicas,
+                       num_threads_per_replica,
+                       std::forward<Args>(args)...) {
+    }
+    template <typename... Args>
+    TranslatorPool(const PlacementOptions& placement,
+                   size_t num_replicas,
+                   size_t num_threads_per_replica,
+                   Args&&... args) {
       _translator_pool.emplace_back(std::forward<Args>(args)...);
-      // On GPU, we don't benefit much from running in parallel. Even though the code is
-      // using separate streams for each thread, there is still some synchronization points.
-      if (_translator_pool.back().device() == Device::CUDA)
-        num_replicas = 1;
-      for (size_t i = 1; i < num_replicas; ++i)
-        _translator_pool.emplace_back(_translator_pool.front());
-      for (auto& translator : _translator_pool)
-        _workers.emplace_back(&TranslatorPool::work_loop,
-                              this,
-                              std::ref(translator),
-                              num_threads_per_replica);
+      create_replicas(placement, num_replicas, num_threads_per_replica);
     }
     ~TranslatorPool();
 
+    size_t num_replicas() const {
+      return _translator_pool.size();
+    }
+
+    // Cache the results of up to max_memory_bytes (0 disables the cache). Jobs that
+    // use a vocabulary map or a callback are not cached. Identical examples of a
+    // batch are then also translated once. This method should be called before
+    // posting jobs.
+    void set_cache(size_t max_memory_bytes, size_t num_shards = 16);
+    const TranslationCache* cache() const {
+      return _cache.get();
+    }
+
+    // Cache the encoder outputs of up to max_memory_bytes, shared by all replicas
+    // (0 disables the cache). This method should be called before posting jobs.
+    void set_encoder_cache(size_t max_memory_bytes);
+
+    // Enable or disable the merging of queued jobs.
+    void set_batching_options(const BatchingOptions& options);
+
+    // Split the translation between encoder workers and the pool workers, which then
+    // only run the decoding. This method should be called once, before posting jobs.
+    // The pipeline is only supported on CPU.
+    void set_pipeline_options(const PipelineOptions& options);
+
     // Run a translation job asynchronously.
     std::future<TranslationOutput> post(const TranslationInput& source,
                                         const TranslationOptions& options);
     std::future<TranslationOutput> post(const TranslationInput& source,
                                         const TranslationInput& target_prefix,
                                         const TranslationOptions& options);
+    std::future<TranslationOutput> post(const TranslationInput& source,
+                                        const TranslationInput& target_prefix,
+                                        const TranslationOptions& options,
+                                        const JobOptions& job_options);
+
+    // Same as post but calls the callback when the job completes instead of returning a
+    // future. The callback is run by the worker that completed the job (or the calling
+    // thread if the job is fully cached) unless an executor is set, and should not throw.
+    // If the pool is destroyed before the job completes, the callback is called with a
+    // std::runtime_error.
+    void post(const TranslationInput& source,
+              const TranslationInput& target_prefix,
+              const TranslationOptions& options,
+              const JobOptions& job_options,
+              TranslationCallback callback);
+
+    // Run a translation by token ids asynchronously (see Translator::translate_batch_ids).
+    // These jobs are run as posted: they are not merged with other jobs nor cached.
+    std::future<TranslationIdsResult>
+    translate_batch_ids(const std::vector<std::vector<size_t>>& source,
+                        const TranslationOptions& options,
+                        const JobOptions& job_options = JobOptions());
+
+    // Hands the completion callbacks to this executor instead of running them in the
+    // workers (an empty executor restores this default). The executor can be changed
+    // while jobs are running: each callback uses the executor set when it is run. If
+    // the executor throws, the callback is run directly with that error.
+    void set_callback_executor(CallbackExecutor executor);
+
+    // Same as post but returns a handle that can cancel the job.
+    TranslationJobHandle post_cancellable(const TranslationInput& source,
+                                          const TranslationInput& target_prefix,
+                                          const TranslationOptions& options,
+                                          const JobOptions& job_options = JobOptions());
 
     // Translate a stream in parallel.
     // Results will be written in order as they are available so the stream content is
-    // never stored fully in memory.
+    // never stored fully in memory. At most max_inflight_batches batches are posted
+    // but not yet written (0 means 2 times the number of replicas): the reading blocks
+    // when this limit is reached.
+    //
+    // The reader is called from the current thread and the writer is called from a
+    // separate thread, so that reading and writing can overlap.
     template <typename Reader, typename Writer>
     void consume_stream(std::istream& in,
                         std::ostream& out,
                         size_t max_batch_size,
                         const TranslationOptions& options,
                         Reader& reader,
-                        Writer& writer) {
+                        Writer& writer,
+                        size_t max_inflight_batches = 0) {
+      if (max_inflight_batches == 0)
+        max_inflight_batches = 2 * num_replicas();
+
       std::queue<std::future<TranslationOutput>> futures;
+      size_t num_pending = 0;  // Batches that are posted but not fully written.
+      bool end_of_input = false;
+      std::exception_ptr writer_exception;
+      std::mutex mutex;
+      std::condition_variable cv;
+
+      std::thread writer_thread([&]() {
+        while (true) {
+          std::future<TranslationOutput> future;
+          {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&futures, &end_of_input]{
+              return !futures.empty() || end_of_input;
+            });
+            if (futures.empty())
+              break;
+            future = std::move(futures.front());
+            futures.pop();
+          }
 
-      auto pop_results = [&futures, &out, &writer](bool blocking) {
-        static const auto zero_sec = std::chrono::seconds(0);
-        while (!futures.empty()
-               && (blocking
-                   || futures.front().wait_for(zero_sec) == std::future_status::ready)) {
-          for (const auto& result : futures.front().get())
-            writer(out, result);
-          futures.pop();
+          try {
+            for (const auto& result : future.get())
+              writer(out, result);
+          } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            writer_exception = std::current_exception();
+          }
+
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            --num_pending;
+          }
+          cv.notify_all();
+          if (writer_exception)
+            break;
         }
+      });
+
+      // Returns false if the writer failed.
+      auto post_batch = [&](const TranslationInput& batch_tokens) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&num_pending, &writer_exception, max_inflight_batches]{
+          return num_pending < max_inflight_batches || writer_exception;
+        });
+        if (writer_exception)
+          return false;
+        futures.emplace(post(batch_tokens, options));
+        ++num_pending;
+        lock.unlock();
+        cv.notify_all();
+        return true;
       };
 
-      TranslationInput batch_tokens;
-      std::vector<std::string> tokens;
+      auto finish = [&]() {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          end_of_input = true;
+        }
+        cv.notify_all();
+        writer_thread.join();
+      };
+
+      try {
+        TranslationInput batch_tokens;
+        std::vector<std::string> tokens;
 
-      while (reader(in, tokens)) {
-        batch_tokens.push_back(tokens);
-        tokens.clear();
-        if (batch_tokens.size() == max_batch_size) {
-          futures.emplace(post(batch_tokens, options));
-          batch_tokens.clear();
+        while (reader(in, tokens)) {
+          batch_tokens.emplace_back(std::move(tokens));
+          tokens.clear();
+          if (batch_tokens.size() == max_batch_size) {
+            if (!post_batch(batch_tokens))
+              break;
+            batch_tokens.clear();
+          }
         }
-        pop_results(false /* blocking */);
+
+        if (!batch_tokens.empty())
+          post_batch(batch_tokens);
+      } catch (...) {
+        finish();
+        throw;
       }
 
-      if (!batch_tokens.empty())
-        futures.emplace(post(batch_tokens, options));
-      pop_results(true /* blocking */);
+      finish();
+      if (writer_exception)
+        std::rethrow_exception(writer_exception);
+    }
+
+    // Translate a stream in parallel and call batch_callback(batch_index, output) for
+    // each batch as soon as it is translated. Batches may complete out of order and the
+    // callback is run by the workers (see post with a callback), so no thread waits on
+    // a translation. At most max_inflight_batches batches are running at the same time
+    // (0 means 2 times the number of replicas). The first error is rethrown once all
+    // posted batches are completed. The returned value is the number of batches.
+    template <typename Reader, typename BatchCallback>
+    size_t consume_stream(std::istream& in,
+                          size_t max_batch_size,
+                          const TranslationOptions& options,
+                          Reader& reader,
+                          const BatchCallback& batch_callback,
+                          size_t max_inflight_batches = 0) {
+      if (max_inflight_batches == 0)
+        max_inflight_batches = 2 * num_replicas();
+
+      size_t num_batches = 0;
+      size_t num_pending = 0;  // Batches that are posted but not completed.
+      std::exception_ptr first_error;
+      std::mutex mutex;
+      std::condition_variable cv;
+
+      // Returns false if a batch failed.
+      auto post_batch = [&](const TranslationInput& batch_tokens) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&num_pending, &first_error, max_inflight_batches]{
+          return num_pending < max_inflight_batches || first_error;
+        });
+        if (first_error)
+          return false;
+        const size_t batch_index = num_batches++;
+        ++num_pending;
+        lock.unlock();
+
+        try {
+          post(batch_tokens, TranslationInput(), options, JobOptions(),
+               [&, batch_index](std::exception_ptr error, TranslationOutput output) {
+                 if (!error) {
+                   try {
+                     batch_callback(batch_index, std::move(output));
+                   } catch (...) {
+                     error = std::current_exception();
+                   }
+                 }
+                 // Notify under the lock: the waiting thread owns the condition variable.
+                 std::lock_guard<std::mutex> callback_lock(mutex);
+                 if (error && !first_error)
+                   first_error = error;
+                 --num_pending;
+                 cv.notify_all();
+               });
+        } catch (...) {
+          // The callback will not be called.
+          lock.lock();
+          --num_pending;
+          throw;
+        }
+        return true;
+      };
+
+      auto wait_pending = [&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&num_pending]{ return num_pending == 0; });
+      };
+
+      try {
+        TranslationInput batch_tokens;
+        std::vector<std::string> tokens;
+
+        while (reader(in, tokens)) {
+          batch_tokens.emplace_back(std::move(tokens));
+          tokens.clear();
+          if (batch_tokens.size() == max_batch_size) {
+            if (!post_batch(batch_tokens))
+              break;
+            batch_tokens.clear();
+          }
+        }
+
+        if (!batch_tokens.empty())
+          post_batch(batch_tokens);
+      } catch (...) {
+        wait_pending();
+        throw;
+      }
+
+      wait_pending();
+      if (first_error)
+        std::rethrow_exception(first_error);
+      return num_batches;
     }
 
     // Translate a file in parallel.
@@ -102,16 +416,89 @@ namespace ctranslate2 {
       TranslationInput source;
       TranslationInput target_prefix;
       TranslationOptions options;
+      JobOptions job_options;
+      std::promise<TranslationOutput> promise;
+      // If set, the job is completed with this callback instead of the promise.
+      TranslationCallback callback;
+      // If set, the worker runs this function instead of translating the source. The
+      // task completes the job itself (the callback only reports a job failed before
+      // running, e.g. expired).
+      std::function<void(Translator&)> task;
+      // Only set for cancellable jobs.
+      std::shared_ptr<std::atomic<bool>> cancelled;
+      // Only set for cached jobs: the key and the cached result (if any) of each example.
+      std::vector<std::string> cache_keys;
+      std::vector<std::shared_ptr<const TranslationResult>> cached_results;
+    };
+
+    friend class TranslationJobHandle;
+    std::future<TranslationOutput> post_job(TranslationJob job);
+    void cancel_job(const std::shared_ptr<std::atomic<bool>>& cancelled);
+    void complete_job(TranslationJob& job, TranslationOutput output);
+    void fail_job(TranslationJob& job, std::exception_ptr error);
+    void run_callback(const TranslationCallback& callback,
+                      std::exception_ptr error,
+                      TranslationOutput output);
+    void create_replicas(const PlacementOptions& placement,
+                         size_t num_replicas,
+                         size_t num_threads_per_replica);
+    struct ThreadAffinity {
+      // CPUs of the worker and its OpenMP threads (empty if not pinned).
+      std::vector<size_t> worker_cpus;
+      // If set, the CPUs of each team thread. The worker itself (thread 0) keeps
+      // worker_cpus.
+      std::vector<std::vector<size_t>> team_cpus;
+    };
+    // Jobs that are translated in a single batch.
+    struct JobBatch {
+      std::vector<TranslationJob> jobs;
+      // Examples to translate: cached examples are skipped and identical examples
+      // are translated once.
+      TranslationInput source;
+      TranslationInput target_prefix;
+      std::vector<std::pair<size_t, size_t>> owners;  // (job, example) of each example.
+      std::vector<std::vector<size_t>> batch_index;   // Index of each job example in source.
+      TranslationOptions options;
+      std::function<bool()> should_stop;
+      // Only set in pipeline mode.
+      std::unique_ptr<EncodedBatch> encoded;
     };
 
-    void work_loop(Translator& translator, size_t intra_threads);
+    void work_loop(Translator& translator, size_t intra_threads, ThreadAffinity affinity);
+    void encode_loop(Translator& translator, size_t intra_threads);
+    void decode_loop(Translator& translator);
+    void take_jobs(std::unique_lock<std::mutex>& lock, std::vector<TranslationJob>& jobs);
+    bool pop_job(std::vector<TranslationJob>& jobs, std::vector<TranslationJob>& expired_jobs);
+    void merge_queued_jobs(std::unique_lock<std::mutex>& lock,
+                           std::vector<TranslationJob>& jobs,
+                           std::vector<TranslationJob>& expired_jobs);
+    std::unique_ptr<JobBatch> make_batch(std::vector<TranslationJob> jobs);
+    void finish_batch(JobBatch& batch, TranslationOutput results);
+    void run_jobs(Translator& translator, std::vector<TranslationJob> jobs);
 
-    std::queue<std::pair<TranslationJob, std::promise<TranslationOutput>>> _work;
+    // One queue per priority class.
+    std::array<std::deque<TranslationJob>, num_job_priorities> _work;
+    BatchingOptions _batching_options;
+    std::unique_ptr<TranslationCache> _cache;
+    std::shared_ptr<const CallbackExecutor> _callback_executor;  // Accessed atomically.
     std::vector<std::thread> _workers;
     std::vector<Translator> _translator_pool;
+    std::vector<std::unique_ptr<Translator>> _encoder_pool;
+    size_t _num_threads_per_replica = 0;
     std::mutex _mutex;
     std::condition_variable _cv;
-    bool _request_end = false;
+    // Pipeline mode: encoded batches waiting for a decoder worker.
+    std::atomic<bool> _pipeline{false};
+    std::deque<std::unique_ptr<JobBatch>> _encoded_batches;
+    size_t _max_encoded_batches = 0;
+    std::condition_variable _encoded_cv;
+    // Idle workers first poll these atomics before waiting on the condition variable.
+    std::atomic<size_t> _num_queued_jobs{0};
+    std::atomic<bool> _request_end{false};
+    size_t _num_waiting_workers = 0;
+    // Workers waiting for more jobs to merge in their batch.
+    std::condition_variable _merge_cv;
+    size_t _num_merging_workers = 0;
   };
 
 }
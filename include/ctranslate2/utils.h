@@ -1,5 +1,7 @@
 #pragma once
 
+#include <vector>
+
 #include "devices.h"
 
 namespace ctranslate2 {
@@ -8,6 +10,22 @@ namespace ctranslate2 {
   bool mayiuse_int16(Device device);
   bool mayiuse_int8(Device device);
 
+  // Sets the number of threads used by operators in the current thread.
   void set_num_threads(size_t num_threads);
 
+  // Returns the CPUs of each NUMA node, or an empty list if the topology is unknown.
+  std::vector<std::vector<size_t>> get_numa_nodes_cpus();
+  // Returns the CPUs of each physical core (i.e. the SMT siblings), ordered by NUMA
+  // node, or an empty list if the topology is unknown.
+  std::vector<std::vector<size_t>> get_physical_cores_cpus();
+  // Restricts the current thread to run on these CPUs. Threads created afterwards by
+  // this thread (e.g. its OpenMP team) inherit the affinity. Returns false if the
+  // affinity could not be set.
+  bool set_thread_affinity(const std::vector<size_t>& cpus);
+
+  // Pins the thread i > 0 of the current thread's team (OpenMP and parallel_for
+  // threads) to cpus[i]. The thread 0 is the current thread: it keeps its affinity
+  // (e.g. the union of the team CPUs). This should be called after set_num_threads.
+  void set_team_affinity(const std::vector<std::vector<size_t>>& cpus);
+
 }
@@ -1,9 +1,11 @@
 import os
 
+import numpy
+
 from setuptools import setup, find_packages, Extension
 
 
-include_dirs = []
+include_dirs = [numpy.get_include()]
 library_dirs = []
 
 def _maybe_add_library_root(lib_name):
@@ -33,6 +35,7 @@ setup(
     packages=find_packages(exclude=["bin"]),
     ext_modules=[ctranslate2_module],
     install_requires=[
+        "numpy",
         "six",
     ],
     entry_points={
@@ -1,5 +1,6 @@
 # -*- coding: utf-8 -*-
 
+import asyncio
 import os
 import pytest
 import numpy as np
@@ -36,6 +37,24 @@ def test_batch_translation():
     assert "attention" not in output[0][0]
     assert output[1][0]["tokens"] == ["a", "c", "h", "i", "s", "o", "n"]
 
+def test_batch_translation_async():
+    translator = _get_transliterator()
+    source = [["آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"], ["آ" ,"ت" ,"ش" ,"ي" ,"س" ,"و" ,"ن"]]
+    expected = translator.translate_batch(source)
+    futures = [translator.translate_batch_async(source) for _ in range(4)]
+    for future in futures:
+        assert future.result() == expected
+    assert translator.translate_batch_async([]).result() == []
+    with pytest.raises(ValueError):
+        translator.translate_batch_async(source, beam_size=1, num_hypotheses=2).result()
+
+    async def _translate_all():
+        return await asyncio.gather(*[
+            asyncio.wrap_future(translator.translate_batch_async([tokens]))
+            for tokens in source])
+    outputs = asyncio.new_event_loop().run_until_complete(_translate_all())
+    assert [output[0] for output in outputs] == expected
+
 def test_file_translation(tmpdir):
     input_path = str(tmpdir.join("input.txt"))
     output_path = str(tmpdir.join("output.txt"))
@@ -85,6 +104,37 @@ def test_return_attention():
     assert len(attention) == 6  # Target length.
     assert len(attention[0]) == 6  # Source length.
 
+def _read_vocabulary(filename):
+    model_path = os.path.join(_TEST_DATA_DIR, "models", "v2", "aren-transliteration")
+    with open(os.path.join(model_path, filename), encoding="utf-8") as vocab_file:
+        return [line.rstrip("\n") for line in vocab_file]
+
+def test_batch_translation_ids():
+    translator = _get_transliterator()
+    source_vocab = _read_vocabulary("source_vocabulary.txt")
+    target_vocab = _read_vocabulary("target_vocabulary.txt")
+    source = [["آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"], ["آ" ,"ت" ,"ش" ,"ي" ,"س" ,"و" ,"ن"]]
+    ids = np.zeros((2, 7), dtype=np.int32)
+    for i, tokens in enumerate(source):
+        ids[i, :len(tokens)] = [source_vocab.index(token) for token in tokens]
+    lengths = np.array([6, 7], dtype=np.int32)
+    expected = translator.translate_batch(source, beam_size=2, num_hypotheses=2)
+    output = translator.translate_batch_ids(
+        ids, lengths=lengths, beam_size=2, num_hypotheses=2, return_attention=True)
+    assert output["ids"].dtype == np.int32
+    assert output["scores"].dtype == np.float32
+    assert output["lengths"].shape == (2, 2)
+    assert output["attention"].shape[:3] == output["ids"].shape
+    assert output["attention"].shape[3] == 7  # Maximum source length.
+    for b in range(2):
+        for h in range(2):
+            length = output["lengths"][b, h]
+            tokens = [target_vocab[i] for i in output["ids"][b, h, :length]]
+            assert tokens == expected[b][h]["tokens"]
+            assert output["scores"][b, h] == pytest.approx(expected[b][h]["score"], abs=1e-4)
+    with pytest.raises(ValueError):
+        translator.translate_batch_ids(ids.astype(np.float32))
+
 @pytest.mark.skipif(
     not os.path.isdir(os.path.join(_TEST_DATA_DIR, "models", "transliteration-aren-all")),
     reason="Data files are not available")
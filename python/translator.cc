@@ -1,6 +1,13 @@
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
 #include <boost/python.hpp>
 #include <boost/python/stl_iterator.hpp>
 
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+
 #include <ctranslate2/translator_pool.h>
 
 namespace py = boost::python;
@@ -17,6 +24,18 @@ private:
   PyThreadState* _save_state;
 };
 
+class GILAcquirer {
+public:
+  GILAcquirer()
+    : _state(PyGILState_Ensure()) {
+  }
+  ~GILAcquirer() {
+    PyGILState_Release(_state);
+  }
+private:
+  PyGILState_STATE _state;
+};
+
 template <typename T>
 py::list std_vector_to_py_list(const std::vector<T>& v) {
   py::list l;
@@ -38,6 +57,168 @@ static std::vector<std::vector<std::string>> batch_to_vector(const py::object& l
   return v;
 }
 
+static py::list results_to_py_list(const std::vector<ctranslate2::TranslationResult>& results) {
+  py::list py_results;
+  for (const auto& result : results) {
+    py::list batch;
+    for (size_t i = 0; i < result.num_hypotheses(); ++i) {
+      py::dict hyp;
+      hyp["score"] = result.scores()[i];
+      hyp["tokens"] = std_vector_to_py_list(result.hypotheses()[i]);
+      if (result.has_attention()) {
+        py::list attn;
+        for (const auto& attn_vector : result.attention()[i])
+          attn.append(std_vector_to_py_list(attn_vector));
+        hyp["attention"] = attn;
+      }
+      batch.append(hyp);
+    }
+    py_results.append(batch);
+  }
+  return py_results;
+}
+
+static py::object to_py_exception(const std::exception_ptr& error) {
+  PyObject* type = PyExc_RuntimeError;
+  std::string message = "Unknown error";
+  try {
+    std::rethrow_exception(error);
+  } catch (const std::invalid_argument& e) {
+    type = PyExc_ValueError;
+    message = e.what();
+  } catch (const std::exception& e) {
+    message = e.what();
+  } catch (...) {
+  }
+  return py::object(py::handle<>(py::borrowed(type)))(message);
+}
+
+// Resolves a concurrent.futures.Future from the worker thread that completes the
+// translation. The Python objects are only accessed with the GIL held.
+class AsyncTranslationJob {
+public:
+  // Called with the GIL held.
+  AsyncTranslationJob(const py::object& future)
+    : _future(py::incref(future.ptr())) {
+  }
+  ~AsyncTranslationJob() {
+    GILAcquirer acquirer;
+    if (!_completed)
+      set_result(std::make_exception_ptr(
+                   std::runtime_error("The translator was deleted before the job completed")),
+                 ctranslate2::TranslationOutput());
+    py::decref(_future);
+  }
+
+  void complete(std::exception_ptr error, const ctranslate2::TranslationOutput& output) {
+    GILAcquirer acquirer;
+    set_result(error, output);
+  }
+
+private:
+  void set_result(const std::exception_ptr& error, const ctranslate2::TranslationOutput& output) {
+    _completed = true;
+    py::object future{py::handle<>(py::borrowed(_future))};
+    try {
+      if (error)
+        future.attr("set_exception")(to_py_exception(error));
+      else
+        future.attr("set_result")(results_to_py_list(output));
+    } catch (const py::error_already_set&) {
+      PyErr_Print();
+    }
+  }
+
+  PyObject* _future;
+  bool _completed = false;
+};
+
+// Read access to an object exposing the buffer protocol (e.g. a NumPy array).
+class BufferView {
+public:
+  BufferView(const py::object& obj, const char* name) {
+    if (PyObject_GetBuffer(obj.ptr(), &_buffer, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0)
+      py::throw_error_already_set();
+    const char type = _buffer.format[std::strlen(_buffer.format) - 1];
+    if (std::strchr("bhilqBHILQ", type) == nullptr
+        || (_buffer.itemsize != 4 && _buffer.itemsize != 8)) {
+      PyBuffer_Release(&_buffer);
+      throw std::invalid_argument(std::string(name) + " should be an array of 32-bit or 64-bit integers");
+    }
+  }
+  ~BufferView() {
+    PyBuffer_Release(&_buffer);
+  }
+  BufferView(const BufferView&) = delete;
+  BufferView& operator=(const BufferView&) = delete;
+
+  size_t ndim() const {
+    return _buffer.ndim;
+  }
+  size_t dim(size_t i) const {
+    return _buffer.shape[i];
+  }
+  size_t size() const {
+    return _buffer.len / _buffer.itemsize;
+  }
+  // Does not use the Python API so it can be called without the GIL.
+  int64_t at(size_t i) const {
+    if (_buffer.itemsize == 4)
+      return static_cast<const int32_t*>(_buffer.buf)[i];
+    return static_cast<const int64_t*>(_buffer.buf)[i];
+  }
+
+private:
+  Py_buffer _buffer;
+};
+
+// Padded arrays returned by translate_batch_ids. The NumPy arrays are views on these
+// buffers.
+struct IdsOutputBuffers {
+  std::vector<int32_t> ids;        // [batch, num_hypotheses, max_length]
+  std::vector<int32_t> lengths;    // [batch, num_hypotheses]
+  std::vector<float> scores;       // [batch, num_hypotheses]
+  std::vector<float> attention;    // [batch, num_hypotheses, max_length, source_length]
+};
+
+static void release_buffers(PyObject* capsule) {
+  delete static_cast<std::shared_ptr<IdsOutputBuffers>*>(PyCapsule_GetPointer(capsule, nullptr));
+}
+
+template <typename T>
+struct NumpyType;
+template<>
+struct NumpyType<int32_t> {
+  static const int value = NPY_INT32;
+};
+template<>
+struct NumpyType<float> {
+  static const int value = NPY_FLOAT32;
+};
+
+// Returns a NumPy array that is a view on data and keeps the buffers alive.
+template <typename T>
+static py::object make_array(std::vector<T>& data,
+                             std::vector<npy_intp> shape,
+                             const std::shared_ptr<IdsOutputBuffers>& buffers) {
+  PyObject* array = PyArray_SimpleNewFromData(shape.size(),
+                                              shape.data(),
+                                              NumpyType<T>::value,
+                                              data.data());
+  if (!array)
+    py::throw_error_already_set();
+  py::object py_array{py::handle<>(array)};
+  PyObject* owner = PyCapsule_New(new std::shared_ptr<IdsOutputBuffers>(buffers),
+                                  nullptr,
+                                  release_buffers);
+  if (!owner)
+    py::throw_error_already_set();
+  // This steals the reference to owner, even on failure.
+  if (PyArray_SetBaseObject(reinterpret_cast<PyArrayObject*>(array), owner) != 0)
+    py::throw_error_already_set();
+  return py_array;
+}
+
 class TranslatorWrapper
 {
 public:
@@ -47,12 +228,19 @@ public:
                     const std::string& compute_type,
                     size_t inter_threads,
                     size_t intra_threads)
-    : _translator_pool(inter_threads,
-                       intra_threads,
-                       ctranslate2::models::Model::load(model_path,
-                                                        device,
-                                                        device_index,
-                                                        compute_type)) {
+    : _translator_pool(new ctranslate2::TranslatorPool(
+                         inter_threads,
+                         intra_threads,
+                         ctranslate2::models::Model::load(model_path,
+                                                          device,
+                                                          device_index,
+                                                          compute_type))) {
+  }
+
+  ~TranslatorWrapper() {
+    // The workers may need the GIL to complete asynchronous jobs.
+    GILReleaser releaser;
+    _translator_pool.reset();
   }
 
   void translate_file(const std::string& in_file,
@@ -72,9 +260,10 @@ public:
     options.min_decoding_length = min_decoding_length;
     options.num_hypotheses = num_hypotheses;
     options.use_vmap = use_vmap;
+    options.return_scores = with_scores;
 
     GILReleaser releaser;
-    _translator_pool.consume_text_file(in_file, out_file, max_batch_size, options, with_scores);
+    _translator_pool->consume_text_file(in_file, out_file, max_batch_size, options, with_scores);
   }
 
   py::list translate_batch(const py::object& source,
@@ -99,7 +288,7 @@ public:
     options.return_attention = return_attention;
 
     std::vector<ctranslate2::TranslationResult> results;
-    auto future = _translator_pool.post(batch_to_vector(source),
+    auto future = _translator_pool->post(batch_to_vector(source),
                                         batch_to_vector(target_prefix),
                                         options);
 
@@ -108,34 +297,154 @@ public:
       results = future.get();
     }
 
-    py::list py_results;
-    for (const auto& result : results) {
-      py::list batch;
-      for (size_t i = 0; i < result.num_hypotheses(); ++i) {
-        py::dict hyp;
-        hyp["score"] = result.scores()[i];
-        hyp["tokens"] = std_vector_to_py_list(result.hypotheses()[i]);
-        if (result.has_attention()) {
-          py::list attn;
-          for (const auto& attn_vector : result.attention()[i])
-            attn.append(std_vector_to_py_list(attn_vector));
-          hyp["attention"] = attn;
+    return results_to_py_list(results);
+  }
+
+  py::object translate_batch_async(const py::object& source,
+                                   const py::object& target_prefix,
+                                   size_t beam_size,
+                                   size_t num_hypotheses,
+                                   float length_penalty,
+                                   size_t max_decoding_length,
+                                   size_t min_decoding_length,
+                                   bool use_vmap,
+                                   bool return_attention) {
+    // The job can not be cancelled once posted.
+    py::object future = py::import("concurrent.futures").attr("Future")();
+    future.attr("set_running_or_notify_cancel")();
+    if (source.is_none() || py::len(source) == 0) {
+      future.attr("set_result")(py::list());
+      return future;
+    }
+
+    auto options = ctranslate2::TranslationOptions();
+    options.beam_size = beam_size;
+    options.length_penalty = length_penalty;
+    options.max_decoding_length = max_decoding_length;
+    options.min_decoding_length = min_decoding_length;
+    options.num_hypotheses = num_hypotheses;
+    options.use_vmap = use_vmap;
+    options.return_attention = return_attention;
+
+    auto job = std::make_shared<AsyncTranslationJob>(future);
+    _translator_pool->post(batch_to_vector(source),
+                           batch_to_vector(target_prefix),
+                           options,
+                           ctranslate2::JobOptions(),
+                           [job](std::exception_ptr error, ctranslate2::TranslationOutput output) {
+                             job->complete(error, output);
+                           });
+    return future;
+  }
+
+  py::dict translate_batch_ids(const py::object& ids,
+                               const py::object& lengths,
+                               size_t beam_size,
+                               size_t num_hypotheses,
+                               float length_penalty,
+                               size_t max_decoding_length,
+                               size_t min_decoding_length,
+                               bool use_vmap,
+                               bool return_attention) {
+    auto options = ctranslate2::TranslationOptions();
+    options.beam_size = beam_size;
+    options.length_penalty = length_penalty;
+    options.max_decoding_length = max_decoding_length;
+    options.min_decoding_length = min_decoding_length;
+    options.num_hypotheses = num_hypotheses;
+    options.use_vmap = use_vmap;
+    options.return_attention = return_attention;
+
+    BufferView ids_view(ids, "ids");
+    std::unique_ptr<BufferView> lengths_view;
+    if (!lengths.is_none())
+      lengths_view.reset(new BufferView(lengths, "lengths"));
+    if (ids_view.ndim() != 2)
+      throw std::invalid_argument("ids should be a 2D array [batch, time]");
+    const size_t batch_size = ids_view.dim(0);
+    const size_t max_time = ids_view.dim(1);
+    if (lengths_view && lengths_view->size() != batch_size)
+      throw std::invalid_argument("lengths should have one value per batch example");
+
+    auto buffers = std::make_shared<IdsOutputBuffers>();
+    size_t max_length = 0;
+    size_t max_hypotheses = 0;
+    size_t source_length = 0;
+
+    {
+      GILReleaser releaser;
+      std::vector<std::vector<size_t>> source(batch_size);
+      for (size_t b = 0; b < batch_size; ++b) {
+        const size_t length = lengths_view ? lengths_view->at(b) : max_time;
+        if (length > max_time)
+          throw std::invalid_argument("lengths should not be greater than the ids time dimension");
+        source[b].reserve(length);
+        for (size_t t = 0; t < length; ++t)
+          source[b].push_back(ids_view.at(b * max_time + t));
+      }
+
+      const auto result = _translator_pool->translate_batch_ids(source, options).get();
+
+      // Pad the hypotheses in dense arrays.
+      for (size_t b = 0; b < batch_size; ++b) {
+        const size_t begin = result.hypotheses_offsets[b];
+        const size_t end = result.hypotheses_offsets[b + 1];
+        max_hypotheses = std::max(max_hypotheses, end - begin);
+        for (size_t k = begin; k < end; ++k)
+          max_length = std::max(max_length, result.offsets[k + 1] - result.offsets[k]);
+      }
+      source_length = result.attention_size;
+
+      const size_t num_hypotheses_total = batch_size * max_hypotheses;
+      buffers->ids.resize(num_hypotheses_total * max_length, 0);
+      buffers->lengths.resize(num_hypotheses_total, 0);
+      buffers->scores.resize(num_hypotheses_total, 0);
+      if (return_attention)
+        buffers->attention.resize(num_hypotheses_total * max_length * source_length, 0);
+
+      for (size_t b = 0; b < batch_size; ++b) {
+        const size_t begin = result.hypotheses_offsets[b];
+        const size_t end = result.hypotheses_offsets[b + 1];
+        for (size_t k = begin; k < end; ++k) {
+          const size_t index = b * max_hypotheses + (k - begin);
+          const size_t offset = result.offsets[k];
+          const size_t length = result.offsets[k + 1] - offset;
+          buffers->lengths[index] = length;
+          buffers->scores[index] = result.scores[k];
+          std::copy(result.ids.begin() + offset,
+                    result.ids.begin() + offset + length,
+                    buffers->ids.begin() + index * max_length);
+          if (return_attention)
+            std::copy(result.attention.begin() + offset * source_length,
+                      result.attention.begin() + (offset + length) * source_length,
+                      buffers->attention.begin() + index * max_length * source_length);
         }
-        batch.append(hyp);
       }
-      py_results.append(batch);
     }
 
-    return py_results;
+    const npy_intp batch = batch_size;
+    const npy_intp hypotheses = max_hypotheses;
+    const npy_intp length = max_length;
+    py::dict output;
+    output["ids"] = make_array(buffers->ids, {batch, hypotheses, length}, buffers);
+    output["lengths"] = make_array(buffers->lengths, {batch, hypotheses}, buffers);
+    output["scores"] = make_array(buffers->scores, {batch, hypotheses}, buffers);
+    if (return_attention)
+      output["attention"] = make_array(buffers->attention,
+                                       {batch, hypotheses, length, npy_intp(source_length)},
+                                       buffers);
+    return output;
   }
 
 private:
-  ctranslate2::TranslatorPool _translator_pool;
+  std::unique_ptr<ctranslate2::TranslatorPool> _translator_pool;
 };
 
 BOOST_PYTHON_MODULE(translator)
 {
   PyEval_InitThreads();
+  if (_import_array() < 0)
+    py::throw_error_already_set();
   py::class_<TranslatorWrapper, boost::noncopyable>(
     "Translator",
     py::init<std::string, std::string, int, std::string, size_t, size_t>(
@@ -155,6 +464,26 @@ BOOST_PYTHON_MODULE(translator)
           py::arg("min_decoding_length")=1,
           py::arg("use_vmap")=false,
           py::arg("return_attention")=false))
+    .def("translate_batch_async", &TranslatorWrapper::translate_batch_async,
+         (py::arg("source"),
+          py::arg("target_prefix")=py::object(),
+          py::arg("beam_size")=4,
+          py::arg("num_hypotheses")=1,
+          py::arg("length_penalty")=0,
+          py::arg("max_decoding_length")=250,
+          py::arg("min_decoding_length")=1,
+          py::arg("use_vmap")=false,
+          py::arg("return_attention")=false))
+    .def("translate_batch_ids", &TranslatorWrapper::translate_batch_ids,
+         (py::arg("ids"),
+          py::arg("lengths")=py::object(),
+          py::arg("beam_size")=4,
+          py::arg("num_hypotheses")=1,
+          py::arg("length_penalty")=0,
+          py::arg("max_decoding_length")=250,
+          py::arg("min_decoding_length")=1,
+          py::arg("use_vmap")=false,
+          py::arg("return_attention")=false))
     .def("translate_file", &TranslatorWrapper::translate_file,
          (py::arg("input_path"),
           py::arg("output_path"),
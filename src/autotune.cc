@@ -0,0 +1,139 @@
+#include "ctranslate2/autotune.h"
+
+#include <algorithm>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+#include "ctranslate2/translator_pool.h"
+
+namespace ctranslate2 {
+
+  static std::vector<std::string> get_regular_tokens(const Vocabulary& vocabulary) {
+    std::vector<std::string> tokens;
+    for (size_t id = 0; id < vocabulary.size(); ++id) {
+      const std::string& token = vocabulary.to_token(id);
+      if (token != Vocabulary::pad_token
+          && token != Vocabulary::unk_token
+          && token != Vocabulary::bos_token
+          && token != Vocabulary::eos_token)
+        tokens.push_back(token);
+    }
+    if (tokens.empty())
+      throw std::invalid_argument("The source vocabulary has no regular tokens");
+    return tokens;
+  }
+
+  static TranslationInput make_synthetic_batch(const std::vector<std::string>& tokens,
+                                               size_t batch_size,
+                                               size_t sentence_length,
+                                               size_t seed) {
+    TranslationInput batch(batch_size);
+    for (size_t b = 0; b < batch_size; ++b) {
+      batch[b].reserve(sentence_length);
+      for (size_t t = 0; t < sentence_length; ++t)
+        batch[b].push_back(tokens[(seed + b * 7919 + t * 104729) % tokens.size()]);
+    }
+    return batch;
+  }
+
+  static ThreadsConfig run_config(const std::shared_ptr<models::Model>& model,
+                                  const AutotuneOptions& options,
+                                  const TranslationOptions& translation_options,
+                                  const std::vector<std::string>& tokens,
+                                  size_t inter_threads,
+                                  size_t intra_threads,
+                                  size_t batch_size) {
+    TranslatorPool pool(inter_threads, intra_threads, model);
+    inter_threads = pool.num_replicas();
+
+    // Translates one batch per replica and returns the number of generated tokens.
+    auto run_round = [&](size_t round) {
+      std::vector<std::future<TranslationOutput>> futures;
+      for (size_t i = 0; i < inter_threads; ++i) {
+        const size_t seed = round * inter_threads + i;
+        futures.emplace_back(pool.post(make_synthetic_batch(tokens,
+                                                            batch_size,
+                                                            options.sentence_length,
+                                                            seed),
+                                       translation_options));
+      }
+      size_t num_tokens = 0;
+      for (auto& future : futures) {
+        for (const auto& result : future.get())
+          num_tokens += result.output().size();
+      }
+      return num_tokens;
+    };
+
+    run_round(0);  // Warmup.
+
+    const auto start = std::chrono::steady_clock::now();
+    size_t num_tokens = 0;
+    for (size_t round = 1; round <= options.num_batches_per_replica; ++round)
+      num_tokens += run_round(round);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    ThreadsConfig config;
+    config.inter_threads = inter_threads;
+    config.intra_threads = intra_threads;
+    config.batch_size = batch_size;
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+    config.tokens_per_second = seconds > 0 ? num_tokens / seconds : 0;
+    config.batch_latency = std::chrono::duration_cast<std::chrono::milliseconds>(
+      elapsed / std::max(options.num_batches_per_replica, size_t(1)));
+    return config;
+  }
+
+  AutotuneResult autotune_threads(const std::shared_ptr<models::Model>& model,
+                                  const AutotuneOptions& options) {
+    if (options.batch_sizes.empty())
+      throw std::invalid_argument("At least one batch size should be set");
+
+    size_t num_cores = options.num_cores;
+    if (num_cores == 0)
+      num_cores = std::max(std::thread::hardware_concurrency(), 1u);
+    if (model->device() != Device::CPU)
+      num_cores = 1;  // Only one replica is used on GPU.
+
+    TranslationOptions translation_options = options.translation_options;
+    translation_options.min_decoding_length = options.sentence_length;
+    translation_options.max_decoding_length = options.sentence_length;
+    translation_options.callback = nullptr;
+    const auto tokens = get_regular_tokens(model->get_source_vocabulary());
+
+    // Try each split of the cores between the replicas.
+    AutotuneResult result;
+    for (size_t inter_threads = 1; inter_threads <= num_cores; ++inter_threads) {
+      if (num_cores % inter_threads != 0)
+        continue;
+      const size_t intra_threads = num_cores / inter_threads;
+      for (const size_t batch_size : options.batch_sizes)
+        result.configs.emplace_back(run_config(model,
+                                               options,
+                                               translation_options,
+                                               tokens,
+                                               inter_threads,
+                                               intra_threads,
+                                               batch_size));
+    }
+
+    const ThreadsConfig* best = nullptr;
+    for (const auto& config : result.configs) {
+      if (options.max_batch_latency.count() > 0
+          && config.batch_latency > options.max_batch_latency)
+        continue;
+      if (!best || config.tokens_per_second > best->tokens_per_second)
+        best = &config;
+    }
+    if (!best) {
+      best = &*std::min_element(result.configs.begin(), result.configs.end(),
+                                [](const ThreadsConfig& a, const ThreadsConfig& b) {
+                                  return a.batch_latency < b.batch_latency;
+                                });
+    }
+    result.best = *best;
+    return result;
+  }
+
+}
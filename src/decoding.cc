@@ -1,6 +1,11 @@
 #include "ctranslate2/decoding.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 #include "ctranslate2/ops/ops.h"
+#include "ctranslate2/parallel.h"
 
 namespace ctranslate2 {
 
@@ -34,13 +39,27 @@ namespace ctranslate2 {
     input.reshape(original_shape);
   }
 
-  static void expand_to_beam_size(layers::DecoderState& state, size_t beam_size) {
+  static void expand_to_beam_size(const layers::Decoder& decoder,
+                                  layers::DecoderState& state,
+                                  size_t beam_size) {
     for (auto& pair : state) {
-      if (!pair.second.empty())
+      if (!pair.second.empty() && !decoder.is_shared_state(pair.first))
         expand_to_beam_size(pair.second, beam_size);
     }
   }
 
+  // Gathers the states that are shared by all beams of a batch (shared = true) or
+  // the states that are specific to each beam (shared = false).
+  static void gather(const layers::Decoder& decoder,
+                     layers::DecoderState& state,
+                     const StorageView& indices,
+                     bool shared) {
+    for (auto& pair : state) {
+      if (decoder.is_shared_state(pair.first) == shared && !pair.second.empty())
+        gather(pair.second, indices);
+    }
+  }
+
   static void penalize_token(StorageView& log_probs, size_t token) {
     DEVICE_DISPATCH(log_probs.device(),
                     primitives<D>::strided_fill(log_probs.data<float>() + token,
@@ -49,6 +68,177 @@ namespace ctranslate2 {
                                                 log_probs.dim(0)));
   }
 
+  // Selects the best token of each batch without normalizing the full distribution:
+  // the argmax of the log probabilities is the argmax of the logits, and the score
+  // of the selected token only requires the log-sum-exp of the logits. If scores is
+  // nullptr, the log-sum-exp is not computed.
+  static void select_best_tokens(const StorageView& logits,
+                                 bool penalize_end_token,
+                                 size_t end_token,
+                                 StorageView& best_ids,
+                                 StorageView* best_scores) {
+    const size_t depth = logits.dim(-1);
+    const size_t batch_size = logits.size() / depth;
+    best_ids.resize({batch_size, 1});
+    if (best_scores)
+      best_scores->resize({batch_size, 1});
+
+    parallel_for(0, batch_size, grain_size_for(depth), [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        const auto* x = logits.data<float>() + i * depth;
+        size_t best_id = 0;
+        float best_logit = std::numeric_limits<float>::lowest();
+        float max_logit = std::numeric_limits<float>::lowest();
+        for (size_t j = 0; j < depth; ++j) {
+          const float v = x[j];
+          if (v > max_logit)
+            max_logit = v;
+          if (v > best_logit && !(penalize_end_token && j == end_token)) {
+            best_logit = v;
+            best_id = j;
+          }
+        }
+
+        best_ids.data<int32_t>()[i] = best_id;
+        if (best_scores) {
+          float sum = 0;
+          for (size_t j = 0; j < depth; ++j)
+            sum += std::exp(x[j] - max_logit);
+          best_scores->data<float>()[i] = best_logit - max_logit - std::log(sum);
+        }
+      }
+    });
+  }
+
+  static const int32_t root_entry = -1;
+
+  // Tokens expanded by the beam search. Each entry records the token selected by a
+  // beam, the entry of its parent beam in the previous step, and optionally the
+  // attention vector that produced the token, so that a hypothesis can be
+  // reconstructed by backtracking from its last entry.
+  class BeamHistory {
+  public:
+    int32_t add(int32_t token, int32_t parent, const float* attention = nullptr) {
+      _tokens.push_back(token);
+      _parents.push_back(parent);
+      _depths.push_back(depth(parent) + 1);
+      if (attention)
+        _attention.insert(_attention.end(), attention, attention + _attention_size);
+      return static_cast<int32_t>(_tokens.size() - 1);
+    }
+
+    void set_attention_size(size_t size) {
+      _attention_size = size;
+    }
+
+    // Number of tokens leading to "entry".
+    size_t depth(int32_t entry) const {
+      return entry == root_entry ? 0 : _depths[entry];
+    }
+
+    // Returns the deepest entry that is shared by the hypotheses ending with "entries".
+    int32_t common_ancestor(std::vector<int32_t> entries) const {
+      if (entries.empty())
+        return root_entry;
+      while (true) {
+        size_t max_depth = 0;
+        bool same_entry = true;
+        for (const auto entry : entries) {
+          max_depth = std::max(max_depth, depth(entry));
+          same_entry = same_entry && entry == entries.front();
+        }
+        if (same_entry)
+          return entries.front();
+        for (auto& entry : entries) {
+          if (depth(entry) == max_depth)
+            entry = _parents[entry];
+        }
+      }
+    }
+
+    // Returns the tokens leading to "entry", stopping at the first end_token. If
+    // attention is set, it is filled with the attention vector of each token.
+    std::vector<size_t> backtrack(int32_t entry,
+                                  size_t end_token,
+                                  std::vector<std::vector<float>>* attention = nullptr) const {
+      std::vector<size_t> tokens;
+      if (attention)
+        attention->clear();
+      for (; entry != root_entry; entry = _parents[entry]) {
+        tokens.push_back(_tokens[entry]);
+        if (attention) {
+          const auto* attn_vec = _attention.data() + entry * _attention_size;
+          attention->emplace_back(attn_vec, attn_vec + _attention_size);
+        }
+      }
+
+      std::reverse(tokens.begin(), tokens.end());
+      const size_t length = std::find(tokens.begin(), tokens.end(), end_token) - tokens.begin();
+      tokens.resize(length);
+      if (attention) {
+        std::reverse(attention->begin(), attention->end());
+        attention->resize(length);
+      }
+      return tokens;
+    }
+
+  private:
+    std::vector<int32_t> _tokens;
+    std::vector<int32_t> _parents;
+    std::vector<size_t> _depths;
+    std::vector<float> _attention;
+    size_t _attention_size = 0;
+  };
+
+  struct FinishedHypothesis {
+    float score;
+    int32_t entry;  // Last entry in the beam history.
+  };
+
+  // The best finished hypotheses of a batch, sorted from best to worst.
+  class NBestList {
+  public:
+    NBestList(size_t max_size = 0)
+      : _max_size(max_size) {
+      _hypotheses.reserve(max_size + 1);
+    }
+
+    size_t size() const {
+      return _hypotheses.size();
+    }
+
+    bool accepts(float score) const {
+      return _hypotheses.size() < _max_size || score > _hypotheses.back().score;
+    }
+
+    void add(const FinishedHypothesis& hypothesis) {
+      auto it = std::upper_bound(_hypotheses.begin(), _hypotheses.end(), hypothesis.score,
+                                 [](float score, const FinishedHypothesis& h) {
+                                   return score > h.score;
+                                 });
+      _hypotheses.insert(it, hypothesis);
+      if (_hypotheses.size() > _max_size)
+        _hypotheses.pop_back();
+    }
+
+    const std::vector<FinishedHypothesis>& hypotheses() const {
+      return _hypotheses;
+    }
+
+  private:
+    size_t _max_size;
+    std::vector<FinishedHypothesis> _hypotheses;
+  };
+
+  // Calls the callback with the tokens of "ids" after the first "num_emitted" ones.
+  static void emit_tokens(const TokenCallback& callback,
+                          size_t batch_id,
+                          const std::vector<size_t>& ids,
+                          size_t& num_emitted) {
+    for (; num_emitted < ids.size(); ++num_emitted)
+      callback(batch_id, ids[num_emitted]);
+  }
+
   void beam_search(layers::Decoder& decoder,
                    layers::DecoderState& state,
                    StorageView& sample_from,
@@ -64,33 +254,36 @@ namespace ctranslate2 {
                    float length_penalty,
                    std::vector<std::vector<std::vector<size_t>>>& sampled_ids,
                    std::vector<std::vector<float>>& scores,
-                   std::vector<std::vector<std::vector<std::vector<float>>>>* attention) {
+                   std::vector<std::vector<std::vector<std::vector<float>>>>* attention,
+                   const std::function<bool()>& should_stop,
+                   const TokenCallback& callback) {
     size_t max_step = start_step + max_length;
     Device device = memory.device();
     size_t batch_size = sample_from.dim(0);
     size_t cur_batch_size = batch_size;
     const ops::TopK topk_op(beam_size);
-    StorageView alive_seq(sample_from);
-    alive_seq.reshape({batch_size, 1});
+    StorageView topk_ids(sample_from);
+    topk_ids.reshape({batch_size, 1});
+
+    expand_to_beam_size(decoder, state, beam_size);
+    expand_to_beam_size(topk_ids, beam_size);
 
-    expand_to_beam_size(state, beam_size);
-    expand_to_beam_size(alive_seq, beam_size);
+    // History entry of each alive beam.
+    BeamHistory history;
+    std::vector<int32_t> alive_entries(batch_size * beam_size, root_entry);
 
-    StorageView tiled_memory(memory);
-    StorageView tiled_memory_lengths(memory_lengths);
-    expand_to_beam_size(tiled_memory, beam_size);
-    expand_to_beam_size(tiled_memory_lengths, beam_size);
+    // The memory is not expanded to the beam size: the decoder shares it between the
+    // beams of each batch.
+    StorageView alive_memory(memory);
+    StorageView alive_memory_lengths(memory_lengths);
 
     StorageView gather_indices(DataType::DT_INT32);
-    StorageView topk_ids(alive_seq);
     StorageView topk_scores;
     StorageView topk_log_probs({beam_size}, std::numeric_limits<float>::lowest());
     topk_log_probs.at<float>(0) = 0;
     tile(topk_log_probs, StorageView({1}, static_cast<int32_t>(batch_size)));
 
-    using Result = std::pair<std::vector<size_t>, std::vector<std::vector<float>>>;
-    std::vector<std::map<float, Result>> hypotheses;
-    hypotheses.resize(batch_size);
+    std::vector<NBestList> hypotheses(batch_size, NBestList(num_hypotheses));
     sampled_ids.clear();
     sampled_ids.resize(batch_size);
     scores.clear();
@@ -101,6 +294,8 @@ namespace ctranslate2 {
     }
 
     std::vector<bool> top_beam_finished(batch_size, false);
+    std::vector<size_t> num_emitted_tokens(callback ? batch_size : 0, 0);
+    std::vector<int32_t> candidate_entries;
     std::vector<size_t> batch_offset(batch_size);
     for (size_t i = 0; i < batch_size; ++i) {
       batch_offset[i] = i;
@@ -116,16 +311,17 @@ namespace ctranslate2 {
     StorageView topk_scores_device(device);
     StorageView gather_indices_device(device, DataType::DT_INT32);
 
-    StorageView alive_attention;
     StorageView attention_step;
     StorageView attention_step_device(device);
 
     for (size_t step = start_step; step < max_step; ++step) {
+      if (should_stop && should_stop())
+        break;
       // Compute log probs for the current step.
       decoder(step,
               topk_ids.to(device),
-              tiled_memory,
-              tiled_memory_lengths,
+              alive_memory,
+              alive_memory_lengths,
               state,
               &logits,
               attention ? &attention_step_device : nullptr);
@@ -159,16 +355,20 @@ namespace ctranslate2 {
 
       topk_scores = topk_scores_device.to(Device::CPU);
       topk_ids = topk_ids_device.to(Device::CPU);
-      if (attention)
+      if (attention) {
         attention_step.copy_from(attention_step_device);
+        history.set_attention_size(attention_step.dim(-1));
+      }
 
       topk_log_probs = topk_scores;
       // Recover the true log probs if length penalty was applied.
       if (length_penalty != 0)
         ops::Mul()(topk_log_probs, StorageView(length_penalty_weight), topk_log_probs);
 
-      // Unflatten the ids.
+      // Unflatten the ids and append them to the history.
       gather_indices.resize({cur_batch_size * beam_size});
+      std::vector<int32_t> parent_entries(std::move(alive_entries));
+      alive_entries.resize(topk_ids.size());
       for (size_t i = 0; i < topk_ids.size(); ++i) {
         auto flat_id = topk_ids.at<int32_t>(i);
         auto beam_id = flat_id / vocabulary_size;
@@ -177,31 +377,19 @@ namespace ctranslate2 {
         if (!candidates.empty())
           word_id = candidates.scalar_at<int32_t>({word_id});
         topk_ids.at<int32_t>(i) = word_id;
-        gather_indices.at<int32_t>(i) = beam_id + batch_id * beam_size;
+        const int32_t parent = beam_id + batch_id * beam_size;
+        gather_indices.at<int32_t>(i) = parent;
+        // The attention vector of the token comes from its parent beam.
+        alive_entries[i] = history.add(word_id,
+                                       parent_entries[parent],
+                                       attention
+                                       ? attention_step.data<float>() + parent * attention_step.dim(-1)
+                                       : nullptr);
       }
 
-      // Append last prediction.
-      gather(alive_seq, gather_indices);
-      alive_seq.reshape({cur_batch_size, beam_size, alive_seq.dim(-1)});
-      topk_ids.reshape({cur_batch_size, beam_size, 1});
-      StorageView cur_alive_seq(std::move(alive_seq));
-      ops::Concat(-1)({&cur_alive_seq, &topk_ids}, alive_seq);
       topk_log_probs.reshape({cur_batch_size, beam_size});
       topk_scores.reshape({cur_batch_size, beam_size});
       topk_ids.reshape({cur_batch_size, beam_size});
-      if (attention) {
-        if (alive_attention.empty())
-          alive_attention = attention_step;
-        else {
-          gather(alive_attention, gather_indices);
-          StorageView cur_alive_attention(std::move(alive_attention));
-          ops::Concat(1)({&cur_alive_attention, &attention_step}, alive_attention);
-        }
-        alive_attention.reshape({cur_batch_size,
-                                 beam_size,
-                                 alive_attention.dim(1),
-                                 alive_attention.dim(2)});
-      }
 
       // Check if some hypotheses are finished.
       std::vector<bool> finished(cur_batch_size, false);
@@ -217,30 +405,11 @@ namespace ctranslate2 {
             // Prevent this beam from advancing in the next step.
             topk_log_probs.at<float>({i, k}) = -1e10;
             // Save the finished hypothesis only if it is still a candidate.
-            if (hypotheses[batch_id].size() < num_hypotheses
-                || -score < hypotheses[batch_id].rbegin()->first) {
-              std::vector<size_t> hypothesis;
-              std::vector<std::vector<float>> attn;
-              size_t max_time = alive_seq.dim(-1);
-              hypothesis.reserve(max_time);
-              if (attention)
-                attn.reserve(max_time);
-              for (size_t t = 1; t < max_time; ++t) {
-                size_t id = alive_seq.at<int32_t>({i, k, t});
-                if (id == end_token)
-                  break;
-                hypothesis.push_back(id);
-                if (attention) {
-                  const auto* attn_vec = alive_attention.index<float>({i, k, t - 1});
-                  attn.emplace_back(attn_vec, attn_vec + alive_attention.dim(-1));
-                }
-              }
-
-              // Use -score as the key to iterate the map from best to worst.
-              hypotheses[batch_id].emplace(std::piecewise_construct,
-                                           std::forward_as_tuple(-score),
-                                           std::forward_as_tuple(std::move(hypothesis),
-                                                                 std::move(attn)));
+            if (hypotheses[batch_id].accepts(score)) {
+              FinishedHypothesis hypothesis;
+              hypothesis.score = score;
+              hypothesis.entry = alive_entries[i * beam_size + k];
+              hypotheses[batch_id].add(hypothesis);
             }
           }
         }
@@ -250,16 +419,34 @@ namespace ctranslate2 {
           finished[i] = true;
 
           // Return the "num_hypotheses" best hypotheses.
-          for (auto& pair : hypotheses[batch_id]) {
-            if (sampled_ids[batch_id].size() >= num_hypotheses)
-              break;
-            scores[batch_id].push_back(-pair.first);
-            sampled_ids[batch_id].emplace_back(std::move(pair.second.first));
-            if (attention) {
-              (*attention)[batch_id].emplace_back(std::move(pair.second.second));
-            }
+          for (const auto& hypothesis : hypotheses[batch_id].hypotheses()) {
+            std::vector<std::vector<float>> attn;
+            std::vector<size_t> ids = history.backtrack(hypothesis.entry,
+                                                        end_token,
+                                                        attention ? &attn : nullptr);
+            if (attention)
+              (*attention)[batch_id].emplace_back(std::move(attn));
+            scores[batch_id].push_back(hypothesis.score);
+            sampled_ids[batch_id].emplace_back(std::move(ids));
+          }
+          hypotheses[batch_id] = NBestList();
+          if (callback)
+            emit_tokens(callback, batch_id, sampled_ids[batch_id][0], num_emitted_tokens[batch_id]);
+        } else if (callback) {
+          // Emit the tokens that are shared by all alive beams and finished hypotheses.
+          candidate_entries.clear();
+          for (size_t k = 0; k < beam_size; ++k) {
+            if (topk_ids.at<int32_t>({i, k}) != static_cast<int32_t>(end_token))
+              candidate_entries.push_back(alive_entries[i * beam_size + k]);
           }
-          hypotheses[batch_id].clear();
+          for (const auto& hypothesis : hypotheses[batch_id].hypotheses())
+            candidate_entries.push_back(hypothesis.entry);
+          const int32_t ancestor = history.common_ancestor(candidate_entries);
+          if (history.depth(ancestor) > num_emitted_tokens[batch_id])
+            emit_tokens(callback,
+                        batch_id,
+                        history.backtrack(ancestor, end_token),
+                        num_emitted_tokens[batch_id]);
         }
       }
 
@@ -271,8 +458,6 @@ namespace ctranslate2 {
       if (finished_count > 0) {
         // Reshape to gather on batch dim.
         gather_indices.reshape({cur_batch_size, beam_size});
-        tiled_memory.reshape({cur_batch_size, beam_size, tiled_memory.dim(1), tiled_memory.dim(2)});
-        tiled_memory_lengths.reshape({cur_batch_size, beam_size});
         cur_batch_size -= finished_count;
         StorageView keep_batches({cur_batch_size}, DataType::DT_INT32);
         size_t write_index = 0;
@@ -287,31 +472,29 @@ namespace ctranslate2 {
         }
         gather(topk_ids, keep_batches);
         gather(topk_log_probs, keep_batches);
-        gather(alive_seq, keep_batches);
-        if (attention)
-          gather(alive_attention, keep_batches);
         gather(gather_indices, keep_batches);
+        for (size_t b = 0; b < cur_batch_size; ++b) {
+          const size_t read_batch = keep_batches.at<int32_t>(b);
+          std::copy_n(alive_entries.begin() + read_batch * beam_size,
+                      beam_size,
+                      alive_entries.begin() + b * beam_size);
+        }
+        alive_entries.resize(cur_batch_size * beam_size);
         auto keep_batches_device = keep_batches.to(device);
-        gather(tiled_memory, keep_batches_device);
-        gather(tiled_memory_lengths, keep_batches_device);
+        gather(alive_memory, keep_batches_device);
+        gather(alive_memory_lengths, keep_batches_device);
+        gather(decoder, state, keep_batches_device, /*shared=*/true);
         // Reshape back to the flat repr.
         gather_indices.reshape({cur_batch_size * beam_size});
-        tiled_memory.reshape({cur_batch_size * beam_size, tiled_memory.dim(2), tiled_memory.dim(3)});
-        tiled_memory_lengths.reshape({cur_batch_size * beam_size});
       }
 
       topk_ids.reshape({cur_batch_size * beam_size, 1});
       topk_log_probs.reshape({cur_batch_size * beam_size});
-      alive_seq.reshape({cur_batch_size * beam_size, alive_seq.dim(-1)});
-      if (attention)
-        alive_attention.reshape({cur_batch_size * beam_size,
-                                 alive_attention.dim(2),
-                                 alive_attention.dim(3)});
 
 
       // Reorder states.
       gather_indices_device.copy_from(gather_indices);
-      gather(state, gather_indices_device);
+      gather(decoder, state, gather_indices_device, /*shared=*/false);
     }
   }
 
@@ -327,7 +510,10 @@ namespace ctranslate2 {
                      size_t min_length,
                      std::vector<std::vector<std::vector<size_t>>>& sampled_ids,
                      std::vector<std::vector<float>>& scores,
-                     std::vector<std::vector<std::vector<std::vector<float>>>>* attention) {
+                     std::vector<std::vector<std::vector<std::vector<float>>>>* attention,
+                     bool return_scores,
+                     const std::function<bool()>& should_stop,
+                     const TokenCallback& callback) {
     size_t max_step = start_step + max_length;
     Device device = memory.device();
     size_t batch_size = sample_from.dim(0);
@@ -366,6 +552,8 @@ namespace ctranslate2 {
     StorageView attention_step_device(device);
 
     for (size_t step = start_step; step < max_step; ++step) {
+      if (should_stop && should_stop())
+        break;
       decoder(step,
               sample_from.to(device),
               alive_memory,
@@ -373,22 +561,32 @@ namespace ctranslate2 {
               state,
               &logits,
               attention ? &attention_step_device : nullptr);
-      ops::LogSoftMax()(logits, log_probs);
-
-      // Penalize end_token, if configured.
-      if (step < min_length)
-        penalize_token(log_probs, end_token);
 
-      ops::TopK(1)(log_probs, best_probs_device, best_ids_device);
-      best_probs.copy_from(best_probs_device);
-      best_ids.copy_from(best_ids_device);
+      if (device == Device::CPU) {
+        select_best_tokens(logits,
+                           step < min_length,
+                           end_token,
+                           best_ids,
+                           return_scores ? &best_probs : nullptr);
+      } else {
+        ops::LogSoftMax()(logits, log_probs);
+
+        // Penalize end_token, if configured.
+        if (step < min_length)
+          penalize_token(log_probs, end_token);
+
+        ops::TopK(1)(log_probs, best_probs_device, best_ids_device);
+        best_probs.copy_from(best_probs_device);
+        best_ids.copy_from(best_ids_device);
+      }
       if (attention)
         attention_step.copy_from(attention_step_device);
 
-      std::vector<bool> finished_batch(log_probs.dim(0), false);
+      const size_t cur_batch_size = logits.dim(0);
+      std::vector<bool> finished_batch(cur_batch_size, false);
       bool one_finished = false;
       size_t count_alive = 0;
-      for (size_t i = 0; i < log_probs.dim(0); ++i) {
+      for (size_t i = 0; i < cur_batch_size; ++i) {
         size_t true_id = best_ids.scalar_at<int32_t>({i});
         if (!candidates.empty())
           true_id = candidates.scalar_at<int32_t>({true_id});
@@ -400,7 +598,10 @@ namespace ctranslate2 {
         } else {
           sample_from.at<int32_t>(i) = true_id;
           sampled_ids[batch_id][0].push_back(true_id);
-          scores[batch_id][0] += best_probs.scalar_at<float>({i});
+          if (callback)
+            callback(batch_id, true_id);
+          if (return_scores)
+            scores[batch_id][0] += best_probs.scalar_at<float>({i});
           ++count_alive;
           if (attention) {
             const auto* attn = attention_step.index<float>({i});
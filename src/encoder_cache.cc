@@ -0,0 +1,73 @@
+#include "ctranslate2/encoder_cache.h"
+
+namespace ctranslate2 {
+
+  static std::string make_key(const std::vector<std::vector<std::string>>& source) {
+    static const char separator = '\x1f';
+    std::string key;
+    for (const auto& tokens : source) {
+      for (const auto& token : tokens)
+        key += token + separator;
+      key += separator;
+    }
+    return key;
+  }
+
+  EncoderCache::EncoderCache(size_t max_memory_bytes)
+    : _max_memory(max_memory_bytes) {
+  }
+
+  bool EncoderCache::get(const std::vector<std::vector<std::string>>& source,
+                         StorageView& encoded,
+                         layers::DecoderState& state) {
+    const std::string key = make_key(source);
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _index.find(key);
+    if (it == _index.end()) {
+      ++_misses;
+      return false;
+    }
+
+    ++_hits;
+    _entries.splice(_entries.begin(), _entries, it->second);
+    const auto& entry = *it->second;
+    encoded = entry.encoded;
+    for (const auto& pair : entry.state)
+      state[pair.first] = pair.second;
+    return true;
+  }
+
+  void EncoderCache::put(const std::vector<std::vector<std::string>>& source,
+                         const StorageView& encoded,
+                         layers::DecoderState state) {
+    size_t memory_usage = encoded.reserved_memory();
+    for (const auto& pair : state)
+      memory_usage += pair.second.reserved_memory();
+    if (memory_usage > _max_memory)
+      return;
+
+    std::string key = make_key(source);
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_index.find(key) != _index.end())
+      return;
+
+    while (_memory_usage + memory_usage > _max_memory) {
+      _memory_usage -= _entries.back().memory_usage;
+      _index.erase(_entries.back().key);
+      _entries.pop_back();
+    }
+
+    _entries.emplace_front(Entry{std::move(key), encoded, std::move(state), memory_usage});
+    _index.emplace(_entries.front().key, _entries.begin());
+    _memory_usage += memory_usage;
+  }
+
+  size_t EncoderCache::hits() const {
+    return _hits;
+  }
+
+  size_t EncoderCache::misses() const {
+    return _misses;
+  }
+
+}
@@ -10,6 +10,18 @@ namespace ctranslate2 {
                                          StorageView& output,
                                          StorageView* attention,
                                          float queries_scale) {
+      // Packed inputs (see MultiHeadAttention::split_heads) are only supported by the
+      // fused kernel, which does not materialize the attention probabilities.
+      const bool packed = queries.rank() == 3;
+      if (packed && attention != nullptr)
+        throw std::invalid_argument("Attention vectors can not be returned for packed inputs");
+
+      if (packed || (attention == nullptr && queries.device() == Device::CPU)) {
+        const ops::DotProductAttention attention_op(queries_scale);
+        attention_op(queries, keys, values, values_lengths, output);
+        return;
+      }
+
       ops::MatMul(false, true, queries_scale)(queries, keys, output);
 
       StorageView attn(values.device());
@@ -68,10 +80,7 @@ namespace ctranslate2 {
           split_keys.shallow_copy(*cached_keys);
           split_values.shallow_copy(*cached_values);
         } else {
-          _linear[1](*memory, fused_proj);
-          ops::Split(-1)(fused_proj, keys_proj, values_proj);
-          split_heads(keys_proj, split_keys);
-          split_heads(values_proj, split_values);
+          compute_memory_proj(*memory, split_keys, split_values);
           if (cached_keys != nullptr) {
             *cached_keys = split_keys;
             *cached_values = split_values;
@@ -94,22 +103,76 @@ namespace ctranslate2 {
       const float queries_scale = 1.0 / sqrt(dk);
 
       StorageView& context = queries_proj;  // Reuse storage.
-      _attention(split_queries,
-                 split_keys,
-                 split_values,
-                 memory_lengths,
-                 context,
-                 attention,
-                 queries_scale);
-
       StorageView& combined = values_proj;  // Reuse storage.
+
+      // When the memory is shared by consecutive queries batches (e.g. the beams of
+      // a sentence), merge these queries in the time dimension so that they attend
+      // their keys and values in a single batched product.
+      const size_t group_size = (memory && split_queries.rank() == 4
+                                 ? split_queries.dim(0) / split_keys.dim(0)
+                                 : 1);
+      if (group_size > 1) {
+        const size_t batch_size = split_keys.dim(0);
+        const size_t queries_time = split_queries.dim(2);
+        const size_t queries_depth = split_queries.dim(3);
+        StorageView& grouped_queries = fused_proj;  // Reuse storage.
+        split_queries.reshape({batch_size, group_size, _num_heads, queries_time * queries_depth});
+        _transpose_op(split_queries, grouped_queries);
+        grouped_queries.reshape({batch_size, _num_heads, group_size * queries_time, queries_depth});
+
+        _attention(grouped_queries,
+                   split_keys,
+                   split_values,
+                   memory_lengths,
+                   combined,
+                   attention,
+                   queries_scale);
+
+        const size_t values_depth = combined.dim(3);
+        combined.reshape({batch_size, _num_heads, group_size, queries_time * values_depth});
+        _transpose_op(combined, context);
+        context.reshape({batch_size * group_size, _num_heads, queries_time, values_depth});
+        if (attention)
+          attention->reshape({batch_size * group_size, queries_time, attention->dim(-1)});
+      } else {
+        _attention(split_queries,
+                   split_keys,
+                   split_values,
+                   memory_lengths,
+                   context,
+                   attention,
+                   queries_scale);
+      }
+
       combine_heads(context, combined);
 
       _linear.back()(combined, output);
       ops::Add()(queries, output, output);
     }
 
+    void MultiHeadAttention::compute_memory_proj(const StorageView& memory,
+                                                 StorageView& keys,
+                                                 StorageView& values) {
+      const Device device = memory.device();
+      StorageView fused_proj(device);
+      StorageView keys_proj(device);
+      StorageView values_proj(device);
+      _linear[1](memory, fused_proj);
+      ops::Split(-1)(fused_proj, keys_proj, values_proj);
+      split_heads(keys_proj, keys);
+      split_heads(values_proj, values);
+    }
+
     void MultiHeadAttention::split_heads(const StorageView& x, StorageView& y) {
+      if (x.rank() == 2) {
+        // Packed sequences [total_time, depth] are split to [heads, total_time, depth / heads].
+        static const ops::Transpose packed_transpose_op({1, 0, 2});
+        const StorageView z({x.dim(0), _num_heads, x.dim(1) / _num_heads},
+                            const_cast<float*>(x.data<float>()),
+                            x.device());
+        packed_transpose_op(z, y);
+        return;
+      }
       const StorageView z({x.dim(0), x.dim(1), _num_heads, x.dim(2) / _num_heads},
                           const_cast<float*>(x.data<float>()),
                           x.device());
@@ -117,6 +180,12 @@ namespace ctranslate2 {
     }
 
     void MultiHeadAttention::combine_heads(const StorageView& x, StorageView& y) {
+      if (x.rank() == 3) {
+        static const ops::Transpose packed_transpose_op({1, 0, 2});
+        packed_transpose_op(x, y);
+        y.reshape({y.dim(0), y.dim(-1) * _num_heads});
+        return;
+      }
       _transpose_op(x, y);
       y.reshape({y.dim(0), y.dim(1), y.dim(-1) * _num_heads});
     }
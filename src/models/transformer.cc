@@ -60,6 +60,10 @@ namespace ctranslate2 {
       return std::unique_ptr<layers::Decoder>(new TransformerDecoder(*this, "decoder"));
     }
 
+    std::shared_ptr<Model> TransformerModel::clone() const {
+      return std::shared_ptr<Model>(new TransformerModel(*this));
+    }
+
 
     TransformerBaseModel::TransformerBaseModel(const std::string& path, size_t spec_revision)
       : TransformerModel(path, spec_revision, 8) {
@@ -85,6 +89,22 @@ namespace ctranslate2 {
                                                          input.size()));
     }
 
+    void PositionEncoder::operator()(StorageView& input, const StorageView& lengths) {
+      const size_t batch_size = lengths.dim(0);
+      const size_t depth = input.dim(-1);
+      size_t max_time = 0;
+      for (size_t b = 0; b < batch_size; ++b)
+        max_time = std::max(max_time, static_cast<size_t>(lengths.at<int32_t>(b)));
+      const StorageView& encodings = get_position_encoding(max_time, depth, input.device());
+      auto* data = input.data<float>();
+      for (size_t b = 0; b < batch_size; ++b) {
+        const size_t length = lengths.at<int32_t>(b);
+        DEVICE_DISPATCH(input.device(),
+                        primitives<D>::add(encodings.data<float>(), data, length * depth));
+        data += length * depth;
+      }
+    }
+
     const StorageView& PositionEncoder::get_position_encoding(size_t max_time,
                                                               size_t depth,
                                                               Device device) const {
@@ -181,6 +201,12 @@ namespace ctranslate2 {
       return _ff(context, output);
     }
 
+    void TransformerDecoderLayer::compute_memory_state(const StorageView& memory,
+                                                       StorageView& cached_attn_keys,
+                                                       StorageView& cached_attn_values) {
+      _encoder_attention.compute_memory_proj(memory, cached_attn_keys, cached_attn_values);
+    }
+
 
     TransformerEncoder::TransformerEncoder(const TransformerModel& model, const std::string& scope)
       : _embeddings(model, scope + "/embeddings")
@@ -198,20 +224,81 @@ namespace ctranslate2 {
       }
     }
 
+    // Returns the ids of actual tokens (i.e. without padding) as a flat vector, or an
+    // empty storage if the batch does not contain padding.
+    static StorageView pack_ids(const StorageView& ids, const StorageView& lengths) {
+      const size_t batch_size = ids.dim(0);
+      const size_t max_time = ids.dim(1);
+      size_t total_time = 0;
+      for (size_t b = 0; b < batch_size; ++b)
+        total_time += lengths.at<int32_t>(b);
+
+      StorageView packed_ids(DataType::DT_INT32);
+      if (total_time == batch_size * max_time)
+        return packed_ids;
+
+      packed_ids.resize({total_time});
+      auto* dst = packed_ids.data<int32_t>();
+      for (size_t b = 0; b < batch_size; ++b) {
+        const size_t length = lengths.at<int32_t>(b);
+        primitives<>::copy(ids.data<int32_t>() + b * max_time, dst, length);
+        dst += length;
+      }
+      return packed_ids;
+    }
+
+    // Scatters packed sequences [total_time, depth] into a padded [batch, max_time, depth]
+    // output. Padding positions are set to 0.
+    static void unpack_output(const StorageView& packed,
+                              const StorageView& lengths,
+                              size_t max_time,
+                              StorageView& output) {
+      const size_t batch_size = lengths.dim(0);
+      const size_t depth = packed.dim(-1);
+      output.resize({batch_size, max_time, depth});
+      const auto* src = packed.data<float>();
+      auto* dst = output.data<float>();
+      for (size_t b = 0; b < batch_size; ++b) {
+        const size_t length = lengths.at<int32_t>(b);
+        primitives<>::copy(src, dst, length * depth);
+        primitives<>::fill(dst + length * depth, 0.f, (max_time - length) * depth);
+        src += length * depth;
+        dst += max_time * depth;
+      }
+    }
+
     void TransformerEncoder::operator()(const StorageView& ids,
                                         const StorageView& lengths,
                                         StorageView& output) {
       StorageView layer_in(output.device());
       StorageView layer_out(output.device());
-      _embeddings(ids, layer_in);
+
+      // On CPU, padding positions are removed from the batch so that the token-wise
+      // layers (embeddings, projections, feed forward, normalization) only run on
+      // actual tokens. The self-attention then uses the lengths to delimit sequences.
+      StorageView packed_ids(DataType::DT_INT32);
+      if (ids.device() == Device::CPU && ids.dim(0) > 1)
+        packed_ids = pack_ids(ids, lengths);
+      const bool packed = !packed_ids.empty();
+
+      _embeddings(packed ? packed_ids : ids, layer_in);
       ops::Mul()(layer_in, StorageView(static_cast<float>(sqrt(layer_in.dim(-1)))), layer_in);
-      _position_encoder(layer_in);
+      if (packed)
+        _position_encoder(layer_in, lengths);
+      else
+        _position_encoder(layer_in);
 
       for (auto& layer : _layers) {
         layer(layer_in, lengths, layer_out);
         swap(layer_in, layer_out);
       }
-      _output_norm(layer_in, output);
+
+      if (packed) {
+        _output_norm(layer_in, layer_out);
+        unpack_output(layer_out, lengths, ids.dim(1), output);
+      } else {
+        _output_norm(layer_in, output);
+      }
     }
 
 
@@ -251,6 +338,19 @@ namespace ctranslate2 {
       return state;
     }
 
+    bool TransformerDecoder::is_shared_state(const std::string& name) const {
+      // The encoder-attention keys and values only depend on the memory.
+      return name.compare(0, 7, "memory_") == 0;
+    }
+
+    void TransformerDecoder::compute_memory_state(const StorageView& memory,
+                                                  layers::DecoderState& state) {
+      for (size_t l = 0; l < _layers.size(); ++l)
+        _layers[l].compute_memory_state(memory,
+                                        state.at("memory_keys_" + std::to_string(l)),
+                                        state.at("memory_values_" + std::to_string(l)));
+    }
+
     void TransformerDecoder::operator()(size_t step,
                                         const StorageView& ids,
                                         const StorageView& memory,
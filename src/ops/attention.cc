@@ -0,0 +1,161 @@
+#include "ctranslate2/ops/attention.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "ctranslate2/parallel.h"
+
+// Block sizes are chosen so that the scores of a block fit in the L2 cache.
+#define QUERIES_BLOCK_SIZE 64
+#define KEYS_BLOCK_SIZE 128
+
+namespace ctranslate2 {
+  namespace ops {
+
+    // Attends a single sequence and head: y = softmax(scale * q.k^T).v
+    // "scores" should have QUERIES_BLOCK_SIZE * KEYS_BLOCK_SIZE elements.
+    template <Device D, typename T>
+    static void attend(const T* q,
+                       const T* k,
+                       const T* v,
+                       T* y,
+                       size_t queries_time,
+                       size_t keys_time,
+                       size_t depth,
+                       size_t values_depth,
+                       float scale,
+                       T* scores) {
+      if (keys_time == 0) {
+        primitives<D>::fill(y, static_cast<T>(0), queries_time * values_depth);
+        return;
+      }
+
+      T row_max[QUERIES_BLOCK_SIZE];
+      T row_sum[QUERIES_BLOCK_SIZE];
+
+      for (size_t q0 = 0; q0 < queries_time; q0 += QUERIES_BLOCK_SIZE) {
+        const size_t q_size = std::min(static_cast<size_t>(QUERIES_BLOCK_SIZE), queries_time - q0);
+        auto* y_block = y + q0 * values_depth;
+
+        for (size_t k0 = 0; k0 < keys_time; k0 += KEYS_BLOCK_SIZE) {
+          const size_t k_size = std::min(static_cast<size_t>(KEYS_BLOCK_SIZE), keys_time - k0);
+          primitives<D>::gemm(q + q0 * depth, k + k0 * depth,
+                              false, true,
+                              q_size, k_size, depth,
+                              scale, 0.f,
+                              scores);
+
+          // Update the running max and sum of each row and rescale the partial
+          // context accordingly.
+          for (size_t i = 0; i < q_size; ++i) {
+            auto* s = scores + i * k_size;
+            const T block_max = primitives<D>::max(s, k_size);
+            const T new_max = k0 == 0 ? block_max : std::max(row_max[i], block_max);
+            primitives<D>::sub(new_max, s, k_size);
+            primitives<D>::exp(s, s, k_size);
+            const T block_sum = primitives<D>::sum(s, k_size);
+            if (k0 == 0)
+              row_sum[i] = block_sum;
+            else {
+              const T correction = std::exp(row_max[i] - new_max);
+              row_sum[i] = row_sum[i] * correction + block_sum;
+              primitives<D>::mul(correction, y_block + i * values_depth, values_depth);
+            }
+            row_max[i] = new_max;
+          }
+
+          primitives<D>::gemm(scores, v + k0 * values_depth,
+                              false, false,
+                              q_size, values_depth, k_size,
+                              1.f, k0 == 0 ? 0.f : 1.f,
+                              y_block);
+        }
+
+        for (size_t i = 0; i < q_size; ++i)
+          primitives<D>::mul(static_cast<T>(1) / row_sum[i],
+                             y_block + i * values_depth,
+                             values_depth);
+      }
+    }
+
+    template <Device D, typename T>
+    void DotProductAttention::compute(const StorageView& queries,
+                                      const StorageView& keys,
+                                      const StorageView& values,
+                                      const StorageView* values_lengths,
+                                      StorageView& output) const {
+      const size_t depth = queries.dim(-1);
+      const size_t values_depth = values.dim(-1);
+
+      if (queries.rank() == 3) {
+        // Packed sequences: each head is a [total_time, depth] matrix in which the
+        // sequences are stored one after the other.
+        const size_t num_heads = queries.dim(0);
+        const size_t total_time = queries.dim(1);
+        const size_t batch_size = values_lengths->dim(0);
+        std::vector<size_t> offsets(batch_size);
+        for (size_t b = 0, offset = 0; b < batch_size; ++b) {
+          offsets[b] = offset;
+          offset += values_lengths->at<int32_t>(b);
+        }
+
+        const size_t mean_length = batch_size > 0 ? total_time / batch_size : 0;
+        const size_t grain_size = grain_size_for(mean_length * mean_length * depth);
+        parallel_for(0, num_heads * batch_size, grain_size, [&](size_t begin, size_t end) {
+          std::vector<T> scores(QUERIES_BLOCK_SIZE * KEYS_BLOCK_SIZE);
+          for (size_t i = begin; i < end; ++i) {
+            const size_t h = i / batch_size;
+            const size_t b = i % batch_size;
+            const size_t length = values_lengths->at<int32_t>(b);
+            const size_t offset = h * total_time + offsets[b];
+            attend<D>(queries.data<T>() + offset * depth,
+                      keys.data<T>() + offset * depth,
+                      values.data<T>() + offset * values_depth,
+                      output.data<T>() + offset * values_depth,
+                      length, length, depth, values_depth,
+                      _queries_scale,
+                      scores.data());
+          }
+        });
+
+        return;
+      }
+
+      const size_t batch_size = queries.dim(0);
+      const size_t num_heads = queries.dim(1);
+      const size_t queries_time = queries.dim(2);
+      const size_t keys_time = keys.dim(2);
+
+      const size_t grain_size = grain_size_for(queries_time * keys_time * depth);
+      parallel_for(0, batch_size * num_heads, grain_size, [&](size_t begin, size_t end) {
+        std::vector<T> scores(QUERIES_BLOCK_SIZE * KEYS_BLOCK_SIZE);
+        for (size_t i = begin; i < end; ++i) {
+          size_t length = keys_time;
+          if (values_lengths) {
+            const size_t batch_index = (i / num_heads) * values_lengths->dim(0) / batch_size;
+            length = std::min(length, static_cast<size_t>(values_lengths->at<int32_t>(batch_index)));
+          }
+          attend<D>(queries.data<T>() + i * queries_time * depth,
+                    keys.data<T>() + i * keys_time * depth,
+                    values.data<T>() + i * keys_time * values_depth,
+                    output.data<T>() + i * queries_time * values_depth,
+                    queries_time, length, depth, values_depth,
+                    _queries_scale,
+                    scores.data());
+        }
+      });
+    }
+
+#define DECLARE_IMPL(T)                                                 \
+    template void                                                       \
+    DotProductAttention::compute<Device::CPU, T>(                       \
+      const StorageView& queries,                                       \
+      const StorageView& keys,                                          \
+      const StorageView& values,                                        \
+      const StorageView* values_lengths,                                \
+      StorageView& output) const;
+
+    DECLARE_IMPL(float)
+
+  }
+}
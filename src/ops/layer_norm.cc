@@ -1,5 +1,7 @@
 #include "ctranslate2/ops/layer_norm.h"
 
+#include "ctranslate2/parallel.h"
+
 #define EPSILON 0.000001f
 
 namespace ctranslate2 {
@@ -13,19 +15,20 @@ namespace ctranslate2 {
       size_t depth = input.dim(-1);
       size_t batch_size = input.size() / depth;
       StorageView tmp({batch_size, depth}, input.dtype(), input.device());
-      #pragma omp parallel for
-      for (size_t i = 0; i < batch_size; ++i) {
-        const auto* x = input.data<T>() + i * depth;
-        auto* y = output.data<T>() + i * depth;
-        auto* t = tmp.data<T>() + i * depth;
-        auto mean = primitives<>::mean(x, depth);
-        primitives<>::sub(mean, x, y, depth);
-        primitives<>::pow(y, t, static_cast<T>(2), depth);
-        auto variance = primitives<>::mean(t, depth);
-        primitives<>::mul(static_cast<T>(1.0 / sqrt(variance + EPSILON)), y, depth);
-        primitives<>::mul(gamma.data<T>(), y, depth);
-        primitives<>::add(beta.data<T>(), y, depth);
-      }
+      parallel_for(0, batch_size, grain_size_for(depth), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          const auto* x = input.data<T>() + i * depth;
+          auto* y = output.data<T>() + i * depth;
+          auto* t = tmp.data<T>() + i * depth;
+          auto mean = primitives<>::mean(x, depth);
+          primitives<>::sub(mean, x, y, depth);
+          primitives<>::pow(y, t, static_cast<T>(2), depth);
+          auto variance = primitives<>::mean(t, depth);
+          primitives<>::mul(static_cast<T>(1.0 / sqrt(variance + EPSILON)), y, depth);
+          primitives<>::mul(gamma.data<T>(), y, depth);
+          primitives<>::add(beta.data<T>(), y, depth);
+        }
+      });
     }
 
 #define DECLARE_IMPL(T)                                                 \
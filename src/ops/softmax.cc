@@ -1,5 +1,7 @@
 #include "ctranslate2/ops/softmax.h"
 
+#include "ctranslate2/parallel.h"
+
 #define EPSILON 0.000001f
 
 namespace ctranslate2 {
@@ -11,26 +13,27 @@ namespace ctranslate2 {
                           StorageView& output) const {
       size_t total_depth = input.dim(-1);
       size_t batch_size = input.size() / total_depth;
-      #pragma omp parallel for
-      for (size_t i = 0; i < batch_size; ++i) {
-        const auto* x = input.data<T>() + (i * total_depth);
-        auto* y = output.data<T>() + (i * total_depth);
-        size_t depth = total_depth;
-        if (lengths) {
-          // Directly set 0 in output for out of range positions.
-          size_t batch_index = i * lengths->dim(0) / batch_size;
-          depth = lengths->at<int32_t>(batch_index);
-          primitives<>::fill(y + depth, static_cast<float>(0), total_depth - depth);
+      parallel_for(0, batch_size, grain_size_for(total_depth), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          const auto* x = input.data<T>() + (i * total_depth);
+          auto* y = output.data<T>() + (i * total_depth);
+          size_t depth = total_depth;
+          if (lengths) {
+            // Directly set 0 in output for out of range positions.
+            size_t batch_index = i * lengths->dim(0) / batch_size;
+            depth = lengths->at<int32_t>(batch_index);
+            primitives<>::fill(y + depth, static_cast<float>(0), total_depth - depth);
+          }
+          auto max = primitives<>::max(x, depth);
+          primitives<>::sub(max, x, y, depth);
+          primitives<>::exp(y, y, depth);
+          auto sum = primitives<>::sum(y, depth);
+          if (_log)
+            primitives<>::sub(std::log(sum) + max, x, y, depth);
+          else
+            primitives<>::mul(1.f / (sum + EPSILON), y, depth);
         }
-        auto max = primitives<>::max(x, depth);
-        primitives<>::sub(max, x, y, depth);
-        primitives<>::exp(y, y, depth);
-        auto sum = primitives<>::sum(y, depth);
-        if (_log)
-          primitives<>::sub(std::log(sum) + max, x, y, depth);
-        else
-          primitives<>::mul(1.f / (sum + EPSILON), y, depth);
-      }
+      });
     }
 
 #define DECLARE_IMPL(T)                                                 \
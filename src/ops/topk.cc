@@ -4,6 +4,8 @@
 #include <numeric>
 #include <vector>
 
+#include "ctranslate2/parallel.h"
+
 namespace ctranslate2 {
   namespace ops {
 
@@ -15,22 +17,23 @@ namespace ctranslate2 {
       size_t batch_size = x.size() / depth;
       StorageView full_indices({batch_size, depth}, indices.dtype());
 
-      #pragma omp parallel for
-      for (size_t i = 0; i < batch_size; ++i) {
-        const auto* input = x.data<DataType>() + (i * depth);
-        auto* ids = full_indices.data<IndexType>() + (i * depth);
-        auto* val = values.data<DataType>() + (i * _k);
-        auto* ind = indices.data<IndexType>() + (i * _k);
-        std::iota(ids, ids + depth, 0);
-        std::partial_sort(ids, ids + _k, ids + depth,
-                          [&input](const IndexType& i1, const IndexType& i2) {
-                            return input[i1] > input[i2];
-                          });
-        for (size_t j = 0; j < _k; ++j) {
-          ind[j] = ids[j];
-          val[j] = input[ind[j]];
+      parallel_for(0, batch_size, grain_size_for(depth), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          const auto* input = x.data<DataType>() + (i * depth);
+          auto* ids = full_indices.data<IndexType>() + (i * depth);
+          auto* val = values.data<DataType>() + (i * _k);
+          auto* ind = indices.data<IndexType>() + (i * _k);
+          std::iota(ids, ids + depth, 0);
+          std::partial_sort(ids, ids + _k, ids + depth,
+                            [&input](const IndexType& i1, const IndexType& i2) {
+                              return input[i1] > input[i2];
+                            });
+          for (size_t j = 0; j < _k; ++j) {
+            ind[j] = ids[j];
+            val[j] = input[ind[j]];
+          }
         }
-      }
+      });
     }
 
 #define DECLARE_IMPL(T)                                                 \
@@ -0,0 +1,166 @@
+#include "ctranslate2/parallel.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "ctranslate2/utils.h"
+
+#ifdef WITH_MKL
+#  include <mkl.h>
+#endif
+
+namespace ctranslate2 {
+
+  // Set in the threads that are running parallel tasks so that nested loops run inline.
+  static thread_local bool in_parallel_task = false;
+
+  // Threads that run the parallel tasks submitted by a single thread. The submitting
+  // thread also runs tasks, so the pool creates num_threads - 1 threads.
+  class ThreadPool {
+  public:
+    ThreadPool(size_t num_threads, const std::vector<std::vector<size_t>>& cpus) {
+      for (size_t i = 1; i < num_threads; ++i) {
+        std::vector<size_t> thread_cpus;
+        if (i < cpus.size())
+          thread_cpus = cpus[i];
+        _threads.emplace_back(&ThreadPool::work_loop, this, std::move(thread_cpus));
+      }
+    }
+
+    ~ThreadPool() {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _request_end = true;
+      }
+      _work_cv.notify_all();
+      for (auto& thread : _threads)
+        thread.join();
+    }
+
+    size_t num_threads() const {
+      return _threads.size() + 1;
+    }
+
+    void run(size_t num_tasks, const std::function<void(size_t)>& task) {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _task = &task;
+        _num_tasks = num_tasks;
+        _next_task = 0;
+        _num_busy_threads = _threads.size();
+        _exception = nullptr;
+        ++_generation;
+      }
+      _work_cv.notify_all();
+
+      run_tasks();
+
+      std::unique_lock<std::mutex> lock(_mutex);
+      _done_cv.wait(lock, [this]{ return _num_busy_threads == 0; });
+      _task = nullptr;
+      if (_exception)
+        std::rethrow_exception(_exception);
+    }
+
+  private:
+    void work_loop(std::vector<size_t> cpus) {
+      if (!cpus.empty())
+        set_thread_affinity(cpus);
+
+      size_t generation = 0;
+      while (true) {
+        {
+          std::unique_lock<std::mutex> lock(_mutex);
+          _work_cv.wait(lock, [this, generation]{
+            return _request_end || _generation != generation;
+          });
+          if (_request_end)
+            break;
+          generation = _generation;
+        }
+
+        run_tasks();
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (--_num_busy_threads == 0)
+          _done_cv.notify_one();
+      }
+    }
+
+    void run_tasks() {
+      in_parallel_task = true;
+#ifdef WITH_MKL
+      // Tasks run concurrently, so MKL calls in a task should not start their own
+      // threads (0 restores the global setting).
+      const int mkl_num_threads = mkl_set_num_threads_local(1);
+#endif
+      for (size_t i = _next_task++; i < _num_tasks; i = _next_task++) {
+        try {
+          (*_task)(i);
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(_mutex);
+          if (!_exception)
+            _exception = std::current_exception();
+        }
+      }
+#ifdef WITH_MKL
+      mkl_set_num_threads_local(mkl_num_threads);
+#endif
+      in_parallel_task = false;
+    }
+
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _work_cv;
+    std::condition_variable _done_cv;
+    const std::function<void(size_t)>* _task = nullptr;
+    size_t _num_tasks = 0;
+    std::atomic<size_t> _next_task{0};
+    size_t _num_busy_threads = 0;
+    size_t _generation = 0;
+    bool _request_end = false;
+    std::exception_ptr _exception;
+  };
+
+  // Each thread (e.g. each translator replica) has its own parallel_for settings and pool.
+  static thread_local size_t parallel_num_threads = 0;
+  static thread_local std::vector<std::vector<size_t>> parallel_cpus;
+  static thread_local std::unique_ptr<ThreadPool> thread_pool;
+
+  void set_parallel_num_threads(size_t num_threads) {
+    if (num_threads != parallel_num_threads) {
+      parallel_num_threads = num_threads;
+      thread_pool.reset();
+    }
+  }
+
+  size_t get_parallel_num_threads() {
+    if (in_parallel_task)
+      return 1;
+    if (parallel_num_threads == 0)
+      parallel_num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    return parallel_num_threads;
+  }
+
+  void set_parallel_affinity(const std::vector<std::vector<size_t>>& cpus) {
+    parallel_cpus = cpus;
+    thread_pool.reset();
+  }
+
+  void run_parallel_tasks(size_t num_tasks, const std::function<void(size_t)>& task) {
+    const size_t max_threads = get_parallel_num_threads();
+    if (num_tasks <= 1 || max_threads <= 1) {
+      for (size_t i = 0; i < num_tasks; ++i)
+        task(i);
+      return;
+    }
+    if (!thread_pool)
+      thread_pool.reset(new ThreadPool(max_threads, parallel_cpus));
+    thread_pool->run(num_tasks, task);
+  }
+
+}
@@ -25,14 +25,15 @@ namespace ctranslate2 {
   template<>
   void primitives<Device::CPU>::quantize_batch(const float* x, float* scales, int8_t* qx,
                                                size_t batch_size, size_t depth) {
-    #pragma omp parallel for
-    for (size_t i = 0; i < batch_size; ++i) {
-      const float* row = x + i * depth;
-      int8_t* qrow = qx + i * depth;
-      auto scale = static_cast<float>(std::numeric_limits<int8_t>::max()) / amax(row, depth);
-      unary_transform(row, qrow, depth, [scale](float v) { return static_cast<int8_t>(v * scale); });
-      scales[i] = scale;
-    }
+    parallel_for(0, batch_size, grain_size_for(depth), [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        const float* row = x + i * depth;
+        int8_t* qrow = qx + i * depth;
+        auto scale = static_cast<float>(std::numeric_limits<int8_t>::max()) / amax(row, depth);
+        unary_transform(row, qrow, depth, [scale](float v) { return static_cast<int8_t>(v * scale); });
+        scales[i] = scale;
+      }
+    });
   }
 
   template<>
@@ -42,13 +43,14 @@ namespace ctranslate2 {
                                                float* y,
                                                size_t batch_size,
                                                size_t depth) {
-    #pragma omp parallel for
-    for (size_t i = 0; i < batch_size; ++i) {
-      for (size_t j = 0; j < depth; ++j) {
-        const auto index = j + i * depth;
-        y[index] = static_cast<float>(x[index]) / (input_scales[i] * weight_scales[j]);
+    parallel_for(0, batch_size, grain_size_for(depth), [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        for (size_t j = 0; j < depth; ++j) {
+          const auto index = j + i * depth;
+          y[index] = static_cast<float>(x[index]) / (input_scales[i] * weight_scales[j]);
+        }
       }
-    }
+    });
   }
 
 }
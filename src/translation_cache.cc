@@ -0,0 +1,105 @@
+#include "ctranslate2/translation_cache.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace ctranslate2 {
+
+  // Approximate number of bytes used by a cache entry.
+  static size_t entry_size(const std::string& key, const TranslationResult& result) {
+    size_t size = 2 * key.size() + sizeof (TranslationResult) + 64;
+    for (const auto& hypothesis : result.hypotheses()) {
+      for (const auto& token : hypothesis)
+        size += sizeof (std::string) + token.size();
+    }
+    size += result.scores().size() * sizeof (float);
+    for (const auto& attention : result.attention()) {
+      for (const auto& vector : attention)
+        size += vector.size() * sizeof (float);
+    }
+    return size;
+  }
+
+  TranslationCache::TranslationCache(size_t max_memory_bytes, size_t num_shards)
+    : _shards(std::max(num_shards, static_cast<size_t>(1)))
+    , _max_shard_memory(max_memory_bytes / _shards.size()) {
+  }
+
+  std::string TranslationCache::make_key(const std::vector<std::string>& source,
+                                         const std::vector<std::string>& target_prefix,
+                                         const TranslationOptions& options) {
+    static const char separator = '\x1f';
+    std::string key;
+    key += std::to_string(options.beam_size) + separator;
+    key += std::to_string(options.num_hypotheses) + separator;
+    key += std::to_string(options.max_decoding_length) + separator;
+    key += std::to_string(options.min_decoding_length) + separator;
+    key += std::to_string(options.length_penalty) + separator;
+    key += std::to_string(options.use_vmap) + separator;
+    key += std::to_string(options.return_attention) + separator;
+    key += std::to_string(skip_scores(options)) + separator;
+    for (const auto& token : source)
+      key += token + separator;
+    key += separator;
+    for (const auto& token : target_prefix)
+      key += token + separator;
+    return key;
+  }
+
+  TranslationCache::Shard& TranslationCache::get_shard(const std::string& key) {
+    return _shards[std::hash<std::string>()(key) % _shards.size()];
+  }
+
+  std::shared_ptr<const TranslationResult> TranslationCache::get(const std::string& key) {
+    auto& shard = get_shard(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+      ++_misses;
+      return nullptr;
+    }
+    ++_hits;
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    return it->second->second;
+  }
+
+  void TranslationCache::put(const std::string& key, const TranslationResult& result) {
+    const size_t size = entry_size(key, result);
+    if (size > _max_shard_memory)
+      return;
+
+    auto& shard = get_shard(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.index.find(key) != shard.index.end())
+      return;
+
+    while (shard.memory_usage + size > _max_shard_memory) {
+      const auto& last = shard.entries.back();
+      shard.memory_usage -= entry_size(last.first, *last.second);
+      shard.index.erase(last.first);
+      shard.entries.pop_back();
+    }
+
+    shard.entries.emplace_front(key, std::make_shared<const TranslationResult>(result));
+    shard.index.emplace(key, shard.entries.begin());
+    shard.memory_usage += size;
+  }
+
+  size_t TranslationCache::hits() const {
+    return _hits;
+  }
+
+  size_t TranslationCache::misses() const {
+    return _misses;
+  }
+
+  size_t TranslationCache::memory_usage() const {
+    size_t memory_usage = 0;
+    for (const auto& shard : _shards) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      memory_usage += shard.memory_usage;
+    }
+    return memory_usage;
+  }
+
+}
@@ -1,11 +1,22 @@
 #include "ctranslate2/translator.h"
 
+#include <algorithm>
+
 #include "ctranslate2/decoding.h"
 
 namespace ctranslate2 {
 
+  static size_t to_id(const Vocabulary& vocab, const std::string& token) {
+    return vocab.to_id(token);
+  }
+
+  static size_t to_id(const Vocabulary&, size_t id) {
+    return id;
+  }
+
+  template <typename Token>
   static std::pair<StorageView, StorageView>
-  make_inputs(const std::vector<std::vector<std::string>>& tokens,
+  make_inputs(const std::vector<std::vector<Token>>& tokens,
               const Vocabulary& vocab,
               Device device) {
     size_t batch_size = tokens.size();
@@ -22,15 +33,27 @@ namespace ctranslate2 {
     // Convert tokens to ids.
     StorageView ids({batch_size, max_length}, DataType::DT_INT32);
     for (size_t i = 0; i < batch_size; ++i) {
-      for (size_t t = 0; t < tokens[i].size(); ++t) {
-        const std::string& token = tokens[i][t];
-        ids.at<int32_t>({i, t}) = vocab.to_id(token);
-      }
+      for (size_t t = 0; t < tokens[i].size(); ++t)
+        ids.at<int32_t>({i, t}) = to_id(vocab, tokens[i][t]);
     }
 
     return std::make_pair(ids.to(device), lengths.to(device));
   }
 
+  // Unlike the assignment, this does not require both storages to have the same type
+  // and device.
+  // Moves value to the session, unless it is already a view of the session value, and
+  // replaces it by a view of the session value. The decoder and the search never write
+  // into their input states, so they can continue on these views.
+  static void share_with_session(StorageView& session_value, StorageView& value) {
+    if (value.buffer() == session_value.buffer())
+      return;
+    swap(session_value, value);
+    StorageView session_view(session_value.dtype(), session_value.device());
+    if (!session_value.empty())
+      session_view.shallow_copy(session_value);
+    swap(value, session_view);
+  }
 
   Translator::Translator(const std::string& model_dir, Device device, int device_index)
     : _model(models::Model::load(model_dir, device, device_index)) {
@@ -43,7 +66,8 @@ namespace ctranslate2 {
   }
 
   Translator::Translator(const Translator& other)
-    : _model(other._model) {
+    : _model(other._model)
+    , _encoder_cache(other._encoder_cache) {
     make_graph();
   }
 
@@ -75,6 +99,16 @@ namespace ctranslate2 {
     return translate_batch_with_prefix(batch_source, batch_target_prefix, options)[0];
   }
 
+  TranslationResult
+  Translator::translate_with_prefix(const std::vector<std::string>& source,
+                                    const std::vector<std::string>& target_prefix,
+                                    const TranslationOptions& options,
+                                    TranslationSession& session) {
+    std::vector<std::vector<std::string>> batch_source(1, source);
+    std::vector<std::vector<std::string>> batch_target_prefix(1, target_prefix);
+    return run_translation(batch_source, batch_target_prefix, options, nullptr, &session)[0];
+  }
+
   std::vector<TranslationResult>
   Translator::translate_batch(const std::vector<std::vector<std::string>>& batch_tokens) {
     TranslationOptions options;
@@ -91,24 +125,113 @@ namespace ctranslate2 {
   std::vector<TranslationResult>
   Translator::translate_batch_with_prefix(const std::vector<std::vector<std::string>>& source,
                                           const std::vector<std::vector<std::string>>& target_prefix,
-                                          const TranslationOptions& options) {
+                                          const TranslationOptions& options,
+                                          const std::function<bool()>& should_stop) {
+    return run_translation(source, target_prefix, options, should_stop, nullptr);
+  }
+
+  TranslationIdsResult
+  Translator::translate_batch_ids(const std::vector<std::vector<size_t>>& source,
+                                  const TranslationOptions& options,
+                                  const std::function<bool()>& should_stop) {
+    check_options(options);
     const auto& source_vocab = _model->get_source_vocabulary();
     const auto& target_vocab = _model->get_target_vocabulary();
-    const auto& vocab_map = _model->get_vocabulary_map();
-    auto& encoder = *_encoder;
-    auto& decoder = *_decoder;
+    for (const auto& ids : source) {
+      for (const size_t id : ids) {
+        if (id >= source_vocab.size())
+          throw std::invalid_argument("Source token id " + std::to_string(id)
+                                      + " is out of the vocabulary range");
+      }
+    }
+
+    const size_t batch_size = source.size();
+    TranslationIdsResult result;
+    result.offsets.push_back(0);
+    result.hypotheses_offsets.push_back(0);
+    if (batch_size == 0)
+      return result;
+
+    auto scoped_device_setter = _model->get_scoped_device_setter();
+    const auto device = _model->device();
+    auto inputs = make_inputs(source, source_vocab, device);
+    StorageView& ids = inputs.first;
+    StorageView& lengths = inputs.second;
+    StorageView encoded(device);
+    (*_encoder)(ids, lengths, encoded);
+
+    // The vocabulary map is defined on tokens.
+    StorageView candidates(DataType::DT_INT32, device);
+    if (options.use_vmap) {
+      std::vector<std::vector<std::string>> source_tokens(batch_size);
+      for (size_t i = 0; i < batch_size; ++i) {
+        source_tokens[i].reserve(source[i].size());
+        for (const size_t id : source[i])
+          source_tokens[i].emplace_back(source_vocab.to_token(id));
+      }
+      candidates = make_candidates(source_tokens, options);
+    }
+    _decoder->reduce_vocab(candidates);
+
+    auto state = _decoder->initial_state();
+    const size_t start_token = target_vocab.to_id(Vocabulary::bos_token);
+    StorageView sample_from({batch_size}, static_cast<int32_t>(start_token));
+    std::vector<std::vector<std::vector<size_t>>> sampled_ids;
+    std::vector<std::vector<float>> scores;
+    std::vector<std::vector<std::vector<std::vector<float>>>> attention;
+    search(options,
+           encoded,
+           lengths,
+           state,
+           sample_from,
+           candidates,
+           0,
+           should_stop,
+           sampled_ids,
+           scores,
+           options.return_attention ? &attention : nullptr);
 
-    size_t batch_size = source.size();
-    bool with_prefix = !target_prefix.empty();
+    // Flatten the hypotheses.
+    if (options.return_attention)
+      result.attention_size = ids.dim(1);
+    const size_t attention_size = result.attention_size;
+    for (size_t b = 0; b < batch_size; ++b) {
+      for (size_t h = 0; h < sampled_ids[b].size(); ++h) {
+        const auto& hypothesis = sampled_ids[b][h];
+        result.ids.insert(result.ids.end(), hypothesis.begin(), hypothesis.end());
+        result.offsets.push_back(result.ids.size());
+        result.scores.push_back(scores[b][h]);
+        if (options.return_attention) {
+          const auto& vectors = attention[b][h];
+          for (size_t t = 0; t < hypothesis.size(); ++t) {
+            const size_t row_offset = result.attention.size();
+            if (t < vectors.size())
+              result.attention.insert(result.attention.end(), vectors[t].begin(), vectors[t].end());
+            result.attention.resize(row_offset + attention_size, 0);
+          }
+        }
+      }
+      result.hypotheses_offsets.push_back(result.scores.size());
+    }
+    return result;
+  }
 
-    // Check options and inputs.
+  void Translator::check_options(const TranslationOptions& options) const {
+    const auto& vocab_map = _model->get_vocabulary_map();
     if (options.num_hypotheses > options.beam_size)
       throw std::invalid_argument("The number of hypotheses can not be greater than the beam size");
     if (options.use_vmap && vocab_map.empty())
       throw std::invalid_argument("use_vmap is set but the model does not include a vocabulary map");
     if (options.min_decoding_length > options.max_decoding_length)
       throw std::invalid_argument("min_decoding_length is greater than max_decoding_length");
-    if (with_prefix) {
+  }
+
+  void Translator::check_inputs(const std::vector<std::vector<std::string>>& source,
+                                const std::vector<std::vector<std::string>>& target_prefix,
+                                const TranslationOptions& options) const {
+    const size_t batch_size = source.size();
+    check_options(options);
+    if (!target_prefix.empty()) {
       if (options.return_attention)
         throw std::invalid_argument(
           "Prefixed translation currently does not support returning attention vectors");
@@ -120,51 +243,172 @@ namespace ctranslate2 {
                                     + std::to_string(batch_size) + " for source and "
                                     + std::to_string(target_prefix.size()) + " for target prefix");
     }
+  }
 
-    auto scoped_device_setter = _model->get_scoped_device_setter();
-    auto device = _model->device();
+  void Translator::encode(const std::vector<std::vector<std::string>>& source,
+                          StorageView& encoded,
+                          StorageView& lengths,
+                          layers::DecoderState& state,
+                          bool with_memory_state) {
+    auto& encoder = *_encoder;
+    auto& decoder = *_decoder;
 
-    auto inputs = make_inputs(source, source_vocab, device);
+    auto inputs = make_inputs(source, _model->get_source_vocabulary(), _model->device());
     StorageView& ids = inputs.first;
-    StorageView& lengths = inputs.second;
+    lengths = std::move(inputs.second);
+
+    // Reuse the encoder output and the decoder states that depend on it if the
+    // source is cached.
+    if (_encoder_cache && _encoder_cache->get(source, encoded, state))
+      return;
 
-    // Encode sequence.
-    StorageView encoded(device);
     encoder(ids, lengths, encoded);
+    if (_encoder_cache || with_memory_state)
+      decoder.compute_memory_state(encoded, state);
+    if (_encoder_cache) {
+      layers::DecoderState memory_state;
+      for (const auto& pair : state) {
+        if (decoder.is_shared_state(pair.first))
+          memory_state.emplace(pair.first, pair.second);
+      }
+      _encoder_cache->put(source, encoded, std::move(memory_state));
+    }
+  }
+
+  EncodedBatch Translator::encode_batch(const std::vector<std::vector<std::string>>& source) {
+    auto scoped_device_setter = _model->get_scoped_device_setter();
+    auto& decoder = *_decoder;
+
+    const auto device = _model->device();
+    StorageView encoded(device);
+    StorageView lengths(DataType::DT_INT32, device);
+    auto state = decoder.initial_state();
+    encode(source, encoded, lengths, state, /*with_memory_state=*/true);
+
+    EncodedBatch batch;
+    batch.source = source;
+    swap(batch.encoded, encoded);
+    swap(batch.lengths, lengths);
+    for (auto& pair : state) {
+      if (decoder.is_shared_state(pair.first))
+        batch.memory_state.emplace(pair.first, std::move(pair.second));
+    }
+    return batch;
+  }
+
+  std::vector<TranslationResult>
+  Translator::translate_encoded_batch(EncodedBatch batch,
+                                      const std::vector<std::vector<std::string>>& target_prefix,
+                                      const TranslationOptions& options,
+                                      const std::function<bool()>& should_stop) {
+    check_inputs(batch.source, target_prefix, options);
+    auto scoped_device_setter = _model->get_scoped_device_setter();
+
+    auto state = _decoder->initial_state();
+    for (auto& pair : batch.memory_state)
+      state[pair.first] = std::move(pair.second);
+    return decode(batch.source,
+                  target_prefix,
+                  options,
+                  batch.encoded,
+                  batch.lengths,
+                  state,
+                  0,
+                  should_stop,
+                  nullptr);
+  }
+
+  std::vector<TranslationResult>
+  Translator::run_translation(const std::vector<std::vector<std::string>>& source,
+                              const std::vector<std::vector<std::string>>& target_prefix,
+                              const TranslationOptions& options,
+                              const std::function<bool()>& should_stop,
+                              TranslationSession* session) {
+    check_inputs(source, target_prefix, options);
+    auto scoped_device_setter = _model->get_scoped_device_setter();
+    auto device = _model->device();
+
+    auto state = _decoder->initial_state();
+    StorageView encoded(device);
+    StorageView lengths(DataType::DT_INT32, device);
+
+    // Resume from the session state if the source is the same and the target prefix
+    // extends the session prefix.
+    size_t num_forwarded_tokens = 0;
+    const bool resume_session = (session
+                                 && !target_prefix.empty()
+                                 && !session->_source.empty()
+                                 && session->_source == source.front()
+                                 && session->_target_prefix.size() <= target_prefix.front().size()
+                                 && std::equal(session->_target_prefix.begin(),
+                                               session->_target_prefix.end(),
+                                               target_prefix.front().begin()));
+    if (resume_session) {
+      // Continue on views of the session tensors: only the new prefix tokens are
+      // forwarded and the session is then updated without copies.
+      encoded.shallow_copy(session->_encoded);
+      lengths.shallow_copy(session->_lengths);
+      for (auto& pair : session->_state) {
+        if (!pair.second.empty())
+          state.at(pair.first).shallow_copy(pair.second);
+      }
+      num_forwarded_tokens = session->_target_prefix.size();
+    } else {
+      encode(source, encoded, lengths, state, /*with_memory_state=*/false);
+      if (session && !target_prefix.empty()) {
+        // The session is completed by decode once the prefix is forwarded.
+        session->_source.clear();
+        session->_target_prefix.clear();
+        share_with_session(session->_encoded, encoded);
+        share_with_session(session->_lengths, lengths);
+      }
+    }
 
+    return decode(source,
+                  target_prefix,
+                  options,
+                  encoded,
+                  lengths,
+                  state,
+                  num_forwarded_tokens,
+                  should_stop,
+                  session);
+  }
+
+  StorageView
+  Translator::make_candidates(const std::vector<std::vector<std::string>>& source,
+                              const TranslationOptions& options) const {
     // If set, extract the subset of candidates to generate.
-    StorageView candidates(DataType::DT_INT32, device);
+    const auto& vocab_map = _model->get_vocabulary_map();
+    StorageView candidates(DataType::DT_INT32, _model->device());
     if (options.use_vmap && !vocab_map.empty()) {
       auto candidates_vec = vocab_map.get_candidates<int32_t>(source);
       candidates.resize({candidates_vec.size()});
       candidates.copy_from(candidates_vec.data(), candidates_vec.size(), Device::CPU);
     }
-    decoder.reduce_vocab(candidates);
+    return candidates;
+  }
 
-    // Decode.
-    size_t start_step = 0;
-    size_t start_token = target_vocab.to_id(Vocabulary::bos_token);
+  void Translator::search(const TranslationOptions& options,
+                          const StorageView& encoded,
+                          const StorageView& lengths,
+                          layers::DecoderState& state,
+                          StorageView& sample_from,
+                          StorageView& candidates,
+                          size_t start_step,
+                          const std::function<bool()>& should_stop,
+                          std::vector<std::vector<std::vector<size_t>>>& sampled_ids,
+                          std::vector<std::vector<float>>& scores,
+                          std::vector<std::vector<std::vector<std::vector<float>>>>* attention) {
+    const auto& target_vocab = _model->get_target_vocabulary();
+    auto& decoder = *_decoder;
     size_t end_token = target_vocab.to_id(Vocabulary::eos_token);
-    StorageView sample_from({batch_size}, static_cast<int32_t>(start_token));
-    std::vector<std::vector<std::vector<size_t>>> sampled_ids;
-    std::vector<std::vector<float>> scores;
-    std::vector<std::vector<std::vector<std::vector<float>>>> attention;
-    auto* attention_ptr = options.return_attention ? &attention : nullptr;
-    auto state = decoder.initial_state();
 
-    // Forward target prefix, if set (only batch_size = 1 for now).
-    if (with_prefix) {
-      // TODO: Forward all timesteps at once. This requires supporting the masking
-      // of future steps.
-      const auto& prefix = target_prefix.front();
-      start_step = prefix.size();
-      for (size_t i = 0; i < start_step; ++i) {
-        auto input = sample_from.to(device);
-        input.reshape({batch_size, 1});
-        decoder(i, input, encoded, lengths, state);
-        auto next_id = target_vocab.to_id(prefix[i]);
-        sample_from.at<int32_t>(0) = next_id;
-      }
+    TokenCallback callback;
+    if (options.callback) {
+      callback = [&options, &target_vocab](size_t batch_id, size_t id) {
+        options.callback(batch_id, target_vocab.to_token(id));
+      };
     }
 
     if (options.beam_size == 1)
@@ -180,7 +424,10 @@ namespace ctranslate2 {
                     options.min_decoding_length,
                     sampled_ids,
                     scores,
-                    attention_ptr);
+                    attention,
+                    options.return_scores,
+                    should_stop,
+                    callback);
     else
       beam_search(decoder,
                   state,
@@ -197,7 +444,79 @@ namespace ctranslate2 {
                   options.length_penalty,
                   sampled_ids,
                   scores,
-                  attention_ptr);
+                  attention,
+                  should_stop,
+                  callback);
+  }
+
+  std::vector<TranslationResult>
+  Translator::decode(const std::vector<std::vector<std::string>>& source,
+                     const std::vector<std::vector<std::string>>& target_prefix,
+                     const TranslationOptions& options,
+                     const StorageView& encoded,
+                     const StorageView& lengths,
+                     layers::DecoderState& state,
+                     size_t num_forwarded_tokens,
+                     const std::function<bool()>& should_stop,
+                     TranslationSession* session) {
+    const auto& target_vocab = _model->get_target_vocabulary();
+    auto& decoder = *_decoder;
+    const auto device = _model->device();
+    const size_t batch_size = source.size();
+    const bool with_prefix = !target_prefix.empty();
+
+    StorageView candidates = make_candidates(source, options);
+    decoder.reduce_vocab(candidates);
+
+    // Decode.
+    size_t start_step = 0;
+    size_t start_token = target_vocab.to_id(Vocabulary::bos_token);
+    StorageView sample_from({batch_size}, static_cast<int32_t>(start_token));
+    std::vector<std::vector<std::vector<size_t>>> sampled_ids;
+    std::vector<std::vector<float>> scores;
+    std::vector<std::vector<std::vector<std::vector<float>>>> attention;
+
+    // Forward target prefix, if set (only batch_size = 1 for now).
+    if (with_prefix) {
+      // TODO: Forward all timesteps at once. This requires supporting the masking
+      // of future steps.
+      const auto& prefix = target_prefix.front();
+      start_step = prefix.size();
+      if (num_forwarded_tokens > 0)
+        sample_from.at<int32_t>(0) = target_vocab.to_id(prefix[num_forwarded_tokens - 1]);
+      for (size_t i = num_forwarded_tokens; i < start_step; ++i) {
+        auto input = sample_from.to(device);
+        input.reshape({batch_size, 1});
+        decoder(i, input, encoded, lengths, state);
+        auto next_id = target_vocab.to_id(prefix[i]);
+        sample_from.at<int32_t>(0) = next_id;
+      }
+
+      if (session) {
+        session->_source = source.front();
+        session->_target_prefix = prefix;
+        for (auto& pair : state) {
+          auto it = session->_state.find(pair.first);
+          if (it == session->_state.end())
+            it = session->_state.emplace(pair.first,
+                                         StorageView(pair.second.dtype(),
+                                                     pair.second.device())).first;
+          share_with_session(it->second, pair.second);
+        }
+      }
+    }
+
+    search(options,
+           encoded,
+           lengths,
+           state,
+           sample_from,
+           candidates,
+           start_step,
+           should_stop,
+           sampled_ids,
+           scores,
+           options.return_attention ? &attention : nullptr);
 
     // Build results.
     std::vector<TranslationResult> results;
@@ -222,4 +541,12 @@ namespace ctranslate2 {
     return _model->device();
   }
 
+  const models::Model& Translator::model() const {
+    return *_model;
+  }
+
+  void Translator::set_encoder_cache(const std::shared_ptr<EncoderCache>& cache) {
+    _encoder_cache = cache;
+  }
+
 }
@@ -1,19 +1,89 @@
 #include "ctranslate2/translator_pool.h"
 
+#include <algorithm>
 #include <fstream>
+#include <stdexcept>
+#include <unordered_map>
 
 #include "ctranslate2/utils.h"
 
 namespace ctranslate2 {
 
+  // Maximum duration an idle worker polls the queue before waiting on the condition
+  // variable. Jobs posted shortly after each other are then picked up without
+  // a wakeup.
+  static const std::chrono::microseconds max_spin_duration(50);
+
+  // Index of the examples that are not translated (i.e. cached) in a job batch.
+  static const size_t no_index = static_cast<size_t>(-1);
+
+  static std::exception_ptr pool_destroyed_error() {
+    return std::make_exception_ptr(
+      std::runtime_error("The translator pool was destroyed before the job completed"));
+  }
+
   TranslatorPool::~TranslatorPool() {
     {
       std::lock_guard<std::mutex> lock(_mutex);
       _request_end = true;
     }
     _cv.notify_all();  // Request all workers to end their loop.
+    _merge_cv.notify_all();
+    _encoded_cv.notify_all();
     for (auto& worker : _workers)
       worker.join();
+
+    // Fail the encoded batches that were not decoded.
+    for (auto& batch : _encoded_batches) {
+      for (auto& job : batch->jobs)
+        fail_job(job, pool_destroyed_error());
+    }
+
+    // Fail the jobs that were not run.
+    for (auto& queue : _work) {
+      for (auto& job : queue)
+        fail_job(job, pool_destroyed_error());
+    }
+  }
+
+  void TranslatorPool::set_batching_options(const BatchingOptions& options) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _batching_options = options;
+  }
+
+  void TranslatorPool::set_pipeline_options(const PipelineOptions& options) {
+    if (options.num_encoder_workers == 0)
+      return;
+    if (_pipeline)
+      throw std::invalid_argument("The pipeline options can only be set once");
+    // Each thread runs on its own CUDA stream, so the decoder could read the encoder
+    // outputs before they are computed.
+    if (_translator_pool.front().device() == Device::CUDA)
+      throw std::invalid_argument("The encoder/decoder pipeline is not supported on CUDA");
+
+    size_t num_threads_per_encoder = options.num_threads_per_encoder;
+    if (num_threads_per_encoder == 0)
+      num_threads_per_encoder = _num_threads_per_replica;
+    if (num_threads_per_encoder == 0) {
+      const size_t num_workers = num_replicas() + options.num_encoder_workers;
+      num_threads_per_encoder = std::max(std::thread::hardware_concurrency() / num_workers,
+                                         size_t(1));
+    }
+
+    for (size_t i = 0; i < options.num_encoder_workers; ++i)
+      _encoder_pool.emplace_back(new Translator(_translator_pool.front()));
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _max_encoded_batches = std::max(options.max_queued_batches, size_t(1));
+      _pipeline = true;
+    }
+    _cv.notify_all();  // Idle workers switch to the decoding loop.
+
+    for (auto& translator : _encoder_pool)
+      _workers.emplace_back(&TranslatorPool::encode_loop,
+                            this,
+                            std::ref(*translator),
+                            num_threads_per_encoder);
   }
 
   std::future<TranslationOutput> TranslatorPool::post(const TranslationInput& source,
@@ -25,52 +95,700 @@ namespace ctranslate2 {
   std::future<TranslationOutput> TranslatorPool::post(const TranslationInput& source,
                                                       const TranslationInput& target_prefix,
                                                       const TranslationOptions& options) {
-    std::future<TranslationOutput> future;
+    return post(source, target_prefix, options, JobOptions());
+  }
+
+  std::future<TranslationOutput> TranslatorPool::post(const TranslationInput& source,
+                                                      const TranslationInput& target_prefix,
+                                                      const TranslationOptions& options,
+                                                      const JobOptions& job_options) {
     TranslationJob job;
     job.source = source;
     job.target_prefix = target_prefix;
     job.options = options;
+    job.job_options = job_options;
+    return post_job(std::move(job));
+  }
+
+  void TranslatorPool::post(const TranslationInput& source,
+                            const TranslationInput& target_prefix,
+                            const TranslationOptions& options,
+                            const JobOptions& job_options,
+                            TranslationCallback callback) {
+    if (!callback)
+      throw std::invalid_argument("The completion callback is empty");
+    TranslationJob job;
+    job.source = source;
+    job.target_prefix = target_prefix;
+    job.options = options;
+    job.job_options = job_options;
+    job.callback = std::move(callback);
+    post_job(std::move(job));
+  }
+
+  std::future<TranslationIdsResult>
+  TranslatorPool::translate_batch_ids(const std::vector<std::vector<size_t>>& source,
+                                      const TranslationOptions& options,
+                                      const JobOptions& job_options) {
+    auto promise = std::make_shared<std::promise<TranslationIdsResult>>();
+    auto future = promise->get_future();
+    TranslationJob job;
+    job.options = options;
+    job.job_options = job_options;
+    job.task = [promise, source, options](Translator& translator) {
+      try {
+        promise->set_value(translator.translate_batch_ids(source, options));
+      } catch (...) {
+        promise->set_exception(std::current_exception());
+      }
+    };
+    job.callback = [promise](std::exception_ptr error, TranslationOutput) {
+      promise->set_exception(error);
+    };
+    post_job(std::move(job));
+    return future;
+  }
+
+  void TranslatorPool::set_callback_executor(CallbackExecutor executor) {
+    std::shared_ptr<const CallbackExecutor> shared_executor;
+    if (executor)
+      shared_executor = std::make_shared<const CallbackExecutor>(std::move(executor));
+    // The workers may read the executor concurrently.
+    std::atomic_store(&_callback_executor, shared_executor);
+  }
+
+  TranslationJobHandle
+  TranslatorPool::post_cancellable(const TranslationInput& source,
+                                   const TranslationInput& target_prefix,
+                                   const TranslationOptions& options,
+                                   const JobOptions& job_options) {
+    TranslationJob job;
+    job.source = source;
+    job.target_prefix = target_prefix;
+    job.options = options;
+    job.job_options = job_options;
+    job.cancelled = std::make_shared<std::atomic<bool>>(false);
+    auto cancelled = job.cancelled;
+    return TranslationJobHandle(*this, std::move(cancelled), post_job(std::move(job)));
+  }
+
+  void TranslatorPool::set_cache(size_t max_memory_bytes, size_t num_shards) {
+    if (max_memory_bytes == 0)
+      _cache.reset();
+    else
+      _cache.reset(new TranslationCache(max_memory_bytes, num_shards));
+  }
+
+  void TranslatorPool::set_encoder_cache(size_t max_memory_bytes) {
+    std::shared_ptr<EncoderCache> cache;
+    if (max_memory_bytes > 0)
+      cache = std::make_shared<EncoderCache>(max_memory_bytes);
+    for (auto& translator : _translator_pool)
+      translator.set_encoder_cache(cache);
+    for (auto& translator : _encoder_pool)
+      translator->set_encoder_cache(cache);
+  }
+
+  static bool is_cacheable(const TranslationOptions& options) {
+    // The vocabulary map depends on the other examples of the batch.
+    return !options.use_vmap && !options.callback;
+  }
+
+  std::future<TranslationOutput> TranslatorPool::post_job(TranslationJob job) {
+    const size_t priority = static_cast<size_t>(job.job_options.priority);
+    if (priority >= num_job_priorities)
+      throw std::invalid_argument("Invalid job priority");
+    std::future<TranslationOutput> future = job.promise.get_future();
+
+    if (_cache && !job.task && is_cacheable(job.options)) {
+      const size_t batch_size = job.source.size();
+      const std::vector<std::string> empty_prefix;
+      bool all_cached = true;
+      job.cache_keys.reserve(batch_size);
+      job.cached_results.reserve(batch_size);
+      for (size_t i = 0; i < batch_size; ++i) {
+        job.cache_keys.emplace_back(
+          TranslationCache::make_key(job.source[i],
+                                     job.target_prefix.empty() ? empty_prefix : job.target_prefix[i],
+                                     job.options));
+        job.cached_results.emplace_back(_cache->get(job.cache_keys.back()));
+        all_cached = all_cached && job.cached_results.back();
+      }
+
+      // Return immediately when all examples are cached.
+      if (all_cached) {
+        TranslationOutput output;
+        output.reserve(batch_size);
+        for (const auto& result : job.cached_results)
+          output.emplace_back(*result);
+        complete_job(job, std::move(output));
+        return future;
+      }
+    }
 
+    bool notify = false;
+    bool notify_merging = false;
     {
       std::lock_guard<std::mutex> lock(_mutex);
-      _work.emplace(std::piecewise_construct,
-                    std::forward_as_tuple(std::move(job)),
-                    std::forward_as_tuple());
-      future = _work.back().second.get_future();
+      _work[priority].emplace_back(std::move(job));
+      ++_num_queued_jobs;
+      // Spinning workers will find the job by themselves.
+      notify = _num_waiting_workers > 0;
+      notify_merging = _num_merging_workers > 0;
     }
 
-    _cv.notify_one();
+    if (notify)
+      _cv.notify_one();
+    if (notify_merging)
+      _merge_cv.notify_all();
     return future;
   }
 
-  void TranslatorPool::work_loop(Translator& translator, size_t intra_threads) {
-    auto& work_queue = _work;
+  static std::exception_ptr cancelled_error() {
+    return std::make_exception_ptr(std::runtime_error("The translation job was cancelled"));
+  }
+
+  static bool is_cancelled(const std::shared_ptr<std::atomic<bool>>& cancelled) {
+    return cancelled && *cancelled;
+  }
+
+  void TranslatorPool::cancel_job(const std::shared_ptr<std::atomic<bool>>& cancelled) {
+    if (cancelled->exchange(true))
+      return;
+
+    // If the job is still queued, remove it. Otherwise the worker running it will
+    // see the flag.
+    std::vector<TranslationJob> removed_jobs;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      for (auto& queue : _work) {
+        for (auto it = queue.begin(); it != queue.end(); ++it) {
+          if (it->cancelled == cancelled) {
+            removed_jobs.emplace_back(std::move(*it));
+            queue.erase(it);
+            --_num_queued_jobs;
+            break;
+          }
+        }
+      }
+    }
+
+    for (auto& job : removed_jobs)
+      fail_job(job, cancelled_error());
+  }
+
+  void TranslatorPool::complete_job(TranslationJob& job, TranslationOutput output) {
+    if (job.callback)
+      run_callback(job.callback, nullptr, std::move(output));
+    else
+      job.promise.set_value(std::move(output));
+  }
+
+  void TranslatorPool::fail_job(TranslationJob& job, std::exception_ptr error) {
+    if (job.callback)
+      run_callback(job.callback, std::move(error), TranslationOutput());
+    else
+      job.promise.set_exception(std::move(error));
+  }
+
+  void TranslatorPool::run_callback(const TranslationCallback& callback,
+                                    std::exception_ptr error,
+                                    TranslationOutput output) {
+    // An exception escaping a worker would terminate the program and leave the other
+    // jobs of the batch incomplete, so errors thrown by the callback are dropped.
+    const auto executor = std::atomic_load(&_callback_executor);
+    if (executor) {
+      try {
+        auto shared_output = std::make_shared<TranslationOutput>(std::move(output));
+        (*executor)([callback, error, shared_output]() {
+          callback(error, std::move(*shared_output));
+        });
+        return;
+      } catch (...) {
+        // The job should still complete: report the executor error to the callback.
+        error = std::current_exception();
+        output.clear();
+      }
+    }
+
+    try {
+      callback(std::move(error), std::move(output));
+    } catch (...) {
+    }
+  }
+
+  TranslationJobHandle::TranslationJobHandle(TranslatorPool& pool,
+                                             std::shared_ptr<std::atomic<bool>> cancelled,
+                                             std::future<TranslationOutput> future)
+    : _pool(pool)
+    , _cancelled(std::move(cancelled))
+    , _future(std::move(future)) {
+  }
+
+  void TranslationJobHandle::cancel() {
+    _pool.cancel_job(_cancelled);
+  }
+
+  void TranslatorPool::create_replicas(const PlacementOptions& placement,
+                                       size_t num_replicas,
+                                       size_t num_threads_per_replica) {
+    const Device device = _translator_pool.front().device();
+    // On GPU, we don't benefit much from running in parallel. Even though the code is
+    // using separate streams for each thread, there is still some synchronization points.
+    if (device == Device::CUDA)
+      num_replicas = 1;
+
+    std::vector<ThreadAffinity> affinities(num_replicas);
+    if (placement.pin_threads && device == Device::CPU) {
+      const auto cores = get_physical_cores_cpus();
+      if (!cores.empty()) {
+        if (num_threads_per_replica == 0)
+          num_threads_per_replica = std::max(cores.size() / num_replicas, size_t(1));
+        for (size_t i = 0; i < num_replicas; ++i) {
+          auto& affinity = affinities[i];
+          for (size_t t = 0; t < num_threads_per_replica; ++t) {
+            const auto& core = cores[(i * num_threads_per_replica + t) % cores.size()];
+            affinity.team_cpus.emplace_back(core);
+            affinity.worker_cpus.insert(affinity.worker_cpus.end(), core.begin(), core.end());
+          }
+        }
+      }
+    }
+
+    // Assign a NUMA node to each replica.
+    std::vector<std::vector<size_t>> nodes;
+    if (placement.numa_aware && device == Device::CPU)
+      nodes = get_numa_nodes_cpus();
+    std::vector<size_t> replica_nodes(num_replicas, 0);
+    for (size_t i = 0; i < num_replicas && !nodes.empty(); ++i) {
+      auto& affinity = affinities[i];
+      if (affinity.team_cpus.empty()) {
+        replica_nodes[i] = i % nodes.size();
+        affinity.worker_cpus = nodes[replica_nodes[i]];
+      } else {
+        const size_t cpu = affinity.team_cpus.front().front();
+        for (size_t n = 0; n < nodes.size(); ++n) {
+          if (std::find(nodes[n].begin(), nodes[n].end(), cpu) != nodes[n].end())
+            replica_nodes[i] = n;
+        }
+      }
+    }
+
+    std::vector<std::shared_ptr<models::Model>> models(nodes.size());
+    const bool replicate_weights = (placement.replicate_weights
+                                    && num_replicas > 1
+                                    && std::any_of(replica_nodes.begin(),
+                                                   replica_nodes.end(),
+                                                   [&replica_nodes](size_t node) {
+                                                     return node != replica_nodes.front();
+                                                   }));
+    if (replicate_weights) {
+      // Copy the weights from a thread running on each node so that the memory pages
+      // are allocated on this node.
+      std::vector<std::thread> threads;
+      std::exception_ptr exception;
+      std::mutex exception_mutex;
+      for (size_t n = 0; n < nodes.size(); ++n) {
+        if (std::find(replica_nodes.begin(), replica_nodes.end(), n) == replica_nodes.end())
+          continue;
+        threads.emplace_back([&, n]() {
+          try {
+            set_thread_affinity(nodes[n]);
+            models[n] = _translator_pool.front().model().clone();
+          } catch (...) {
+            std::lock_guard<std::mutex> lock(exception_mutex);
+            exception = std::current_exception();
+          }
+        });
+      }
+      for (auto& thread : threads)
+        thread.join();
+      if (exception)
+        std::rethrow_exception(exception);
+
+      _translator_pool.clear();
+      for (size_t i = 0; i < num_replicas; ++i)
+        _translator_pool.emplace_back(models[replica_nodes[i]]);
+    } else {
+      for (size_t i = 1; i < num_replicas; ++i)
+        _translator_pool.emplace_back(_translator_pool.front());
+    }
+
+    _num_threads_per_replica = num_threads_per_replica;
+    for (size_t i = 0; i < _translator_pool.size(); ++i)
+      _workers.emplace_back(&TranslatorPool::work_loop,
+                            this,
+                            std::ref(_translator_pool[i]),
+                            num_threads_per_replica,
+                            std::move(affinities[i]));
+  }
+
+  void TranslatorPool::work_loop(Translator& translator,
+                                 size_t intra_threads,
+                                 ThreadAffinity affinity) {
+    auto& num_queued_jobs = _num_queued_jobs;
     auto& end_requested = _request_end;
 
+    // The affinity is set before the first parallel region so that the OpenMP threads
+    // of this worker are created on the same CPUs.
+    if (!affinity.worker_cpus.empty())
+      set_thread_affinity(affinity.worker_cpus);
+
     // set_num_threads is called here because it sets the number of OpenMP threads for
     // the current thread.
     set_num_threads(intra_threads);
+    if (!affinity.team_cpus.empty())
+      set_team_affinity(affinity.team_cpus);
+
+    // The worker stops polling when a poll timed out, and polls again when it is woken
+    // up shortly after waiting, i.e. when a poll would have found the job.
+    bool spin = true;
 
     while (true) {
+      if (spin) {
+        const auto spin_end = std::chrono::steady_clock::now() + max_spin_duration;
+        while (num_queued_jobs == 0 && !end_requested && !_pipeline) {
+          if (std::chrono::steady_clock::now() >= spin_end) {
+            spin = false;
+            break;
+          }
+          std::this_thread::yield();
+        }
+      }
+
       std::unique_lock<std::mutex> lock(_mutex);
-      _cv.wait(lock, [&work_queue, &end_requested]{
-        return !work_queue.empty() || end_requested;
-      });
+      if (num_queued_jobs == 0 && !end_requested && !_pipeline) {
+        const auto wait_start = std::chrono::steady_clock::now();
+        ++_num_waiting_workers;
+        _cv.wait(lock, [this, &num_queued_jobs, &end_requested]{
+          return num_queued_jobs > 0 || end_requested || _pipeline;
+        });
+        --_num_waiting_workers;
+        spin = std::chrono::steady_clock::now() - wait_start < max_spin_duration;
+      }
 
-      if (end_requested) {
+      if (end_requested)
+        break;
+      if (_pipeline) {
         lock.unlock();
+        decode_loop(translator);
+        break;
+      }
+
+      std::vector<TranslationJob> jobs;
+      take_jobs(lock, jobs);
+      if (!jobs.empty())
+        run_jobs(translator, std::move(jobs));
+    }
+  }
+
+  void TranslatorPool::encode_loop(Translator& translator, size_t intra_threads) {
+    set_num_threads(intra_threads);
+
+    while (true) {
+      std::unique_lock<std::mutex> lock(_mutex);
+      ++_num_waiting_workers;
+      _cv.wait(lock, [this]{ return _num_queued_jobs > 0 || _request_end; });
+      --_num_waiting_workers;
+      if (_request_end)
         break;
+
+      std::vector<TranslationJob> jobs;
+      take_jobs(lock, jobs);
+      if (jobs.empty())
+        continue;
+      if (jobs.front().task) {  // Run by the encoder worker.
+        jobs.front().task(translator);
+        continue;
+      }
+
+      auto batch = make_batch(std::move(jobs));
+      if (batch->source.empty()) {
+        finish_batch(*batch, TranslationOutput());
+        continue;
       }
 
-      auto work_def = std::move(work_queue.front());
-      work_queue.pop();
+      try {
+        batch->encoded.reset(new EncodedBatch(translator.encode_batch(batch->source)));
+      } catch (...) {
+        for (auto& job : batch->jobs)
+          fail_job(job, std::current_exception());
+        continue;
+      }
+
+      lock.lock();
+      _encoded_cv.wait(lock, [this]{
+        return _encoded_batches.size() < _max_encoded_batches || _request_end;
+      });
+      if (_request_end) {
+        lock.unlock();
+        for (auto& job : batch->jobs)
+          fail_job(job, pool_destroyed_error());
+        break;
+      }
+      _encoded_batches.emplace_back(std::move(batch));
       lock.unlock();
+      _encoded_cv.notify_all();
+    }
+  }
 
-      auto& job = work_def.first;
-      auto& promise = work_def.second;
-      promise.set_value(translator.translate_batch_with_prefix(job.source,
-                                                               job.target_prefix,
-                                                               job.options));
+  void TranslatorPool::decode_loop(Translator& translator) {
+    while (true) {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _encoded_cv.wait(lock, [this]{ return !_encoded_batches.empty() || _request_end; });
+      if (_request_end)
+        break;
+      auto batch = std::move(_encoded_batches.front());
+      _encoded_batches.pop_front();
+      lock.unlock();
+      _encoded_cv.notify_all();  // Unblock the encoder workers.
+
+      TranslationOutput results;
+      try {
+        results = translator.translate_encoded_batch(std::move(*batch->encoded),
+                                                     batch->target_prefix,
+                                                     batch->options,
+                                                     batch->should_stop);
+      } catch (...) {
+        for (auto& job : batch->jobs)
+          fail_job(job, std::current_exception());
+        continue;
+      }
+      finish_batch(*batch, std::move(results));
+    }
+  }
+
+  // Pops the next jobs to run and releases the lock.
+  void TranslatorPool::take_jobs(std::unique_lock<std::mutex>& lock,
+                                 std::vector<TranslationJob>& jobs) {
+    std::vector<TranslationJob> expired_jobs;
+    if (pop_job(jobs, expired_jobs) && _batching_options.max_batch_size > 0)
+      merge_queued_jobs(lock, jobs, expired_jobs);
+    lock.unlock();
+
+    for (auto& job : expired_jobs)
+      fail_job(job, std::make_exception_ptr(
+        std::runtime_error("The translation job expired before it could be run")));
+  }
+
+  static bool is_expired(const JobOptions& job_options,
+                         const std::chrono::steady_clock::time_point& now) {
+    return job_options.deadline < now;
+  }
+
+  bool TranslatorPool::pop_job(std::vector<TranslationJob>& jobs,
+                               std::vector<TranslationJob>& expired_jobs) {
+    const auto now = std::chrono::steady_clock::now();
+    for (auto& queue : _work) {
+      while (!queue.empty()) {
+        auto job = std::move(queue.front());
+        queue.pop_front();
+        --_num_queued_jobs;
+        if (is_expired(job.job_options, now))
+          expired_jobs.emplace_back(std::move(job));
+        else {
+          jobs.emplace_back(std::move(job));
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  static bool can_merge(const TranslationInput& target_prefix,
+                        const TranslationOptions& options) {
+    // Prefixed translation does not support batch inputs and the vocabulary map
+    // depends on all sources of the batch.
+    return target_prefix.empty() && !options.use_vmap;
+  }
+
+  // The callbacks are not compared: each job keeps its own callback in a merged batch.
+  static bool same_options(const TranslationOptions& a, const TranslationOptions& b) {
+    return (a.beam_size == b.beam_size
+            && a.num_hypotheses == b.num_hypotheses
+            && a.max_decoding_length == b.max_decoding_length
+            && a.min_decoding_length == b.min_decoding_length
+            && a.length_penalty == b.length_penalty
+            && a.use_vmap == b.use_vmap
+            && a.return_attention == b.return_attention
+            && skip_scores(a) == skip_scores(b));
+  }
+
+  static size_t count_tokens(const TranslationInput& source) {
+    size_t num_tokens = 0;
+    for (const auto& tokens : source)
+      num_tokens += tokens.size();
+    return num_tokens;
+  }
+
+  void TranslatorPool::merge_queued_jobs(std::unique_lock<std::mutex>& lock,
+                                         std::vector<TranslationJob>& jobs,
+                                         std::vector<TranslationJob>& expired_jobs) {
+    const auto& first_job = jobs.front();
+    if (first_job.task || !can_merge(first_job.target_prefix, first_job.options))
+      return;
+
+    const auto max_batch_size = _batching_options.max_batch_size;
+    const auto max_batch_tokens = _batching_options.max_batch_tokens;
+    const auto wait_deadline = std::chrono::steady_clock::now() + _batching_options.max_wait;
+    size_t batch_size = first_job.source.size();
+    size_t batch_tokens = count_tokens(first_job.source);
+
+    // Only jobs of the same priority class are merged.
+    auto& queue = _work[static_cast<size_t>(first_job.job_options.priority)];
+
+    while (true) {
+      const auto now = std::chrono::steady_clock::now();
+      for (auto it = queue.begin(); it != queue.end() && batch_size < max_batch_size;) {
+        const size_t num_tokens = count_tokens(it->source);
+        if (is_expired(it->job_options, now)) {
+          expired_jobs.emplace_back(std::move(*it));
+          it = queue.erase(it);
+          --_num_queued_jobs;
+        } else if (!it->task
+            && can_merge(it->target_prefix, it->options)
+            && same_options(it->options, jobs.front().options)
+            && batch_size + it->source.size() <= max_batch_size
+            && (max_batch_tokens == 0 || batch_tokens + num_tokens <= max_batch_tokens)) {
+          batch_size += it->source.size();
+          batch_tokens += num_tokens;
+          jobs.emplace_back(std::move(*it));
+          it = queue.erase(it);
+          --_num_queued_jobs;
+        } else {
+          ++it;
+        }
+      }
+
+      if (batch_size >= max_batch_size
+          || _request_end
+          || now >= wait_deadline)
+        break;
+
+      // Wait for new jobs to be posted. The worker is not idle so it does not take
+      // the notifications that are meant for idle workers.
+      ++_num_merging_workers;
+      _merge_cv.wait_until(lock, wait_deadline);
+      --_num_merging_workers;
+    }
+  }
+
+  std::unique_ptr<TranslatorPool::JobBatch>
+  TranslatorPool::make_batch(std::vector<TranslationJob> jobs) {
+    std::unique_ptr<JobBatch> batch(new JobBatch);
+    batch->jobs = std::move(jobs);
+    JobBatch* batch_ptr = batch.get();  // The batch address is stable for the closures below.
+
+    // The decoding is stopped when all jobs of the batch are cancelled.
+    if (std::all_of(batch->jobs.begin(), batch->jobs.end(),
+                    [](const TranslationJob& job) { return bool(job.cancelled); })) {
+      batch->should_stop = [batch_ptr]() {
+        return std::all_of(batch_ptr->jobs.begin(), batch_ptr->jobs.end(),
+                           [](const TranslationJob& job) { return bool(*job.cancelled); });
+      };
+    }
+
+    // Collect the examples to translate: cached examples are skipped and identical
+    // examples are translated once.
+    auto& source = batch->source;
+    std::unordered_map<std::string, size_t> unique_examples;
+    bool with_callback = false;
+    batch->batch_index.resize(batch->jobs.size());
+
+    for (size_t j = 0; j < batch->jobs.size(); ++j) {
+      const auto& job = batch->jobs[j];
+      with_callback = with_callback || bool(job.options.callback);
+      for (size_t i = 0; i < job.source.size(); ++i) {
+        size_t index = no_index;
+        if (job.cache_keys.empty()) {
+          index = source.size();
+        } else if (!job.cached_results[i]) {
+          auto it = unique_examples.emplace(job.cache_keys[i], source.size()).first;
+          index = it->second;
+        }
+
+        if (index == source.size()) {
+          source.emplace_back(job.source[i]);
+          if (!job.target_prefix.empty())
+            batch->target_prefix.emplace_back(job.target_prefix[i]);
+          batch->owners.emplace_back(j, i);
+        }
+        batch->batch_index[j].push_back(index);
+      }
+    }
+
+    // Forward the streamed tokens to the callback of each job.
+    batch->options = batch->jobs.front().options;
+    batch->options.callback = nullptr;
+    if (with_callback) {
+      batch->options.callback = [batch_ptr](size_t batch_id, const std::string& token) {
+        const auto& owner = batch_ptr->owners[batch_id];
+        const auto& job = batch_ptr->jobs[owner.first];
+        if (job.options.callback && !is_cancelled(job.cancelled))
+          job.options.callback(owner.second, token);
+      };
+    }
+
+    return batch;
+  }
+
+  void TranslatorPool::run_jobs(Translator& translator, std::vector<TranslationJob> jobs) {
+    if (jobs.front().task) {  // Never merged.
+      jobs.front().task(translator);
+      return;
+    }
+
+    auto batch = make_batch(std::move(jobs));
+    TranslationOutput results;
+    if (!batch->source.empty()) {
+      try {
+        results = translator.translate_batch_with_prefix(batch->source,
+                                                         batch->target_prefix,
+                                                         batch->options,
+                                                         batch->should_stop);
+      } catch (...) {
+        for (auto& job : batch->jobs)
+          fail_job(job, std::current_exception());
+        return;
+      }
+    }
+    finish_batch(*batch, std::move(results));
+  }
+
+  void TranslatorPool::finish_batch(JobBatch& batch, TranslationOutput results) {
+    auto& jobs = batch.jobs;
+    const auto& owners = batch.owners;
+    const auto& batch_index = batch.batch_index;
+
+    // Results are incomplete if the translation was stopped.
+    if (_cache && !(batch.should_stop && batch.should_stop())) {
+      for (size_t b = 0; b < results.size(); ++b) {
+        const auto& job = jobs[owners[b].first];
+        if (!job.cache_keys.empty())
+          _cache->put(job.cache_keys[owners[b].second], results[b]);
+      }
+    }
+
+    // Split the results back into each job.
+    for (size_t j = 0; j < jobs.size(); ++j) {
+      auto& job = jobs[j];
+      if (is_cancelled(job.cancelled)) {
+        fail_job(job, cancelled_error());
+        continue;
+      }
+
+      TranslationOutput output;
+      output.reserve(job.source.size());
+      for (size_t i = 0; i < job.source.size(); ++i) {
+        const size_t index = batch_index[j][i];
+        if (index == no_index)
+          output.emplace_back(*job.cached_results[i]);
+        else if (job.cache_keys.empty())
+          output.emplace_back(std::move(results[index]));  // Not shared with other examples.
+        else
+          output.emplace_back(results[index]);
+      }
+      complete_job(job, std::move(output));
     }
   }
 
@@ -95,23 +813,17 @@ namespace ctranslate2 {
                                            bool with_scores) {
     size_t num_tokens = 0;
 
-    auto reader = [](std::istream& in, std::vector<std::string>& tokens) {
-      std::string line;
+    std::string line;
+    auto reader = [&line](std::istream& in, std::vector<std::string>& tokens) {
       if (!std::getline(in, line))
         return false;
-      std::string token;
-      for (size_t i = 0; i < line.length(); ++i) {
-        if (line[i] == ' ') {
-          if (!token.empty()) {
-            tokens.emplace_back(std::move(token));
-            token.clear();
-          }
-        } else {
-          token += line[i];
-        }
+      size_t start = 0;
+      while (start < line.size()) {
+        const size_t end = std::min(line.find(' ', start), line.size());
+        if (end > start)
+          tokens.emplace_back(line, start, end - start);
+        start = end + 1;
       }
-      if (!token.empty())
-        tokens.emplace_back(std::move(token));
       return true;
     };
 
@@ -127,11 +839,12 @@ namespace ctranslate2 {
             out << ' ';
           out << hypotheses[n][i];
         }
-        out << std::endl;
+        out << '\n';
       }
     };
 
     consume_stream(in, out, max_batch_size, options, reader, writer);
+    out.flush();
     return num_tokens;
   }
 
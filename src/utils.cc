@@ -1,5 +1,17 @@
 #include "ctranslate2/utils.h"
 
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+
+#include "ctranslate2/parallel.h"
+
+#ifdef __linux__
+#  include <pthread.h>
+#  include <sched.h>
+#endif
+
 #ifdef WITH_MKL
 #  include <mkl.h>
 #endif
@@ -54,9 +66,109 @@ namespace ctranslate2 {
   }
 
   void set_num_threads(size_t num_threads) {
+    if (num_threads == 0)
+      return;
+    set_parallel_num_threads(num_threads);
+#ifdef _OPENMP
+    omp_set_num_threads(num_threads);
+#endif
+  }
+
+#ifdef __linux__
+  // Parses a list such as "0-3,8-11" (used for CPU and node lists).
+  static std::vector<size_t> parse_cpu_list(const std::string& list) {
+    std::vector<size_t> cpus;
+    std::istringstream stream(list);
+    std::string range;
+    while (std::getline(stream, range, ',')) {
+      if (range.empty())
+        continue;
+      const size_t sep = range.find('-');
+      const size_t first = std::stoul(range.substr(0, sep));
+      const size_t last = sep == std::string::npos ? first : std::stoul(range.substr(sep + 1));
+      for (size_t cpu = first; cpu <= last; ++cpu)
+        cpus.push_back(cpu);
+    }
+    return cpus;
+  }
+#endif
+
+  std::vector<std::vector<size_t>> get_numa_nodes_cpus() {
+    std::vector<std::vector<size_t>> nodes;
+#ifdef __linux__
+    const std::string sys_node_dir = "/sys/devices/system/node/";
+    std::ifstream online(sys_node_dir + "online");
+    std::string list;
+    if (!std::getline(online, list))
+      return nodes;
+    for (const size_t node : parse_cpu_list(list)) {
+      std::ifstream cpulist(sys_node_dir + "node" + std::to_string(node) + "/cpulist");
+      if (!std::getline(cpulist, list))
+        continue;
+      auto cpus = parse_cpu_list(list);
+      if (!cpus.empty())  // Skip memory-only nodes.
+        nodes.emplace_back(std::move(cpus));
+    }
+#endif
+    return nodes;
+  }
+
+  std::vector<std::vector<size_t>> get_physical_cores_cpus() {
+    std::vector<std::vector<size_t>> cores;
+#ifdef __linux__
+    // List the CPUs node by node so that consecutive cores are on the same node.
+    std::vector<size_t> cpus;
+    for (const auto& node_cpus : get_numa_nodes_cpus())
+      cpus.insert(cpus.end(), node_cpus.begin(), node_cpus.end());
+    const std::string sys_cpu_dir = "/sys/devices/system/cpu/";
+    std::string list;
+    if (cpus.empty()) {
+      std::ifstream online(sys_cpu_dir + "online");
+      if (!std::getline(online, list))
+        return cores;
+      cpus = parse_cpu_list(list);
+    }
+
+    std::unordered_set<size_t> visited_cpus;
+    for (const size_t cpu : cpus) {
+      if (visited_cpus.count(cpu) > 0)
+        continue;
+      std::ifstream siblings(sys_cpu_dir + "cpu" + std::to_string(cpu)
+                             + "/topology/thread_siblings_list");
+      std::vector<size_t> core;
+      if (std::getline(siblings, list))
+        core = parse_cpu_list(list);
+      if (core.empty())
+        core.push_back(cpu);
+      visited_cpus.insert(core.begin(), core.end());
+      cores.emplace_back(std::move(core));
+    }
+#endif
+    return cores;
+  }
+
+  bool set_thread_affinity(const std::vector<size_t>& cpus) {
+#ifdef __linux__
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (const size_t cpu : cpus)
+      CPU_SET(cpu, &cpuset);
+    return pthread_setaffinity_np(pthread_self(), sizeof (cpuset), &cpuset) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+  }
+
+  void set_team_affinity(const std::vector<std::vector<size_t>>& cpus) {
+    set_parallel_affinity(cpus);
 #ifdef _OPENMP
-    if (num_threads != 0)
-      omp_set_num_threads(num_threads);
+    #pragma omp parallel
+    {
+      const size_t thread_id = omp_get_thread_num();
+      if (thread_id > 0 && thread_id < cpus.size())
+        set_thread_affinity(cpus[thread_id]);
+    }
 #endif
   }
 
@@ -1,5 +1,6 @@
 #include "test_utils.h"
 #include "ctranslate2/ops/ops.h"
+#include "ctranslate2/parallel.h"
 
 TEST(OpTest, Transpose1D) {
   StorageView x({4}, std::vector<float>{1, 2, 3, 4});
@@ -75,6 +76,95 @@ TEST(OpTest, QuantizeINT16) {
   expect_storage_eq(reverse, input);
 }
 
+TEST(OpTest, DotProductAttention) {
+  // Use dimensions larger than the kernel blocks to cover the streaming softmax.
+  const size_t batch_size = 2;
+  const size_t num_heads = 2;
+  const size_t queries_time = 70;
+  const size_t keys_time = 150;
+  const size_t depth = 4;
+  StorageView queries({batch_size, num_heads, queries_time, depth});
+  StorageView keys({batch_size, num_heads, keys_time, depth});
+  StorageView values({batch_size, num_heads, keys_time, depth});
+  for (size_t i = 0; i < queries.size(); ++i)
+    queries.at<float>(i) = std::sin(static_cast<float>(i));
+  for (size_t i = 0; i < keys.size(); ++i) {
+    keys.at<float>(i) = std::cos(static_cast<float>(i) * 0.7f);
+    values.at<float>(i) = std::sin(static_cast<float>(i) * 1.3f);
+  }
+  StorageView lengths({batch_size}, std::vector<int32_t>{150, 131});
+  const float scale = 0.5;
+
+  StorageView scores;
+  StorageView probs;
+  StorageView expected;
+  ops::MatMul(false, true, scale)(queries, keys, scores);
+  ops::SoftMax()(scores, lengths, probs);
+  ops::MatMul()(probs, values, expected);
+
+  StorageView output;
+  ops::DotProductAttention op(scale);
+  op(queries, keys, values, &lengths, output);
+  expect_storage_eq(output, expected, 1e-5);
+}
+
+
+TEST(OpTest, DotProductAttentionPacked) {
+  const size_t num_heads = 2;
+  const size_t max_time = 5;
+  const size_t depth = 3;
+  const std::vector<int32_t> lengths_vec = {5, 2};
+  const size_t total_time = 7;
+  StorageView lengths({lengths_vec.size()}, lengths_vec);
+
+  // Build the padded inputs and their packed counterparts.
+  StorageView padded({lengths_vec.size(), num_heads, max_time, depth}, 0.f);
+  StorageView packed({num_heads, total_time, depth});
+  for (size_t h = 0; h < num_heads; ++h) {
+    for (size_t b = 0, offset = 0; b < lengths_vec.size(); offset += lengths_vec[b], ++b) {
+      for (size_t t = 0; t < static_cast<size_t>(lengths_vec[b]); ++t) {
+        for (size_t d = 0; d < depth; ++d) {
+          const float value = std::sin(static_cast<float>(h * 100 + b * 10 + t * 3 + d));
+          padded.at<float>({b, h, t, d}) = value;
+          packed.at<float>({h, offset + t, d}) = value;
+        }
+      }
+    }
+  }
+
+  ops::DotProductAttention op(0.5);
+  StorageView padded_output;
+  StorageView packed_output;
+  op(padded, padded, padded, &lengths, padded_output);
+  op(packed, packed, packed, &lengths, packed_output);
+  for (size_t h = 0; h < num_heads; ++h) {
+    for (size_t b = 0, offset = 0; b < lengths_vec.size(); offset += lengths_vec[b], ++b) {
+      expect_array_eq(packed_output.index<float>({h, offset}),
+                      padded_output.index<float>({b, h, 0}),
+                      lengths_vec[b] * depth,
+                      1e-5f);
+    }
+  }
+}
+
+TEST(OpTest, ParallelFor) {
+  set_parallel_num_threads(4);
+  std::vector<int> counts(1000, 0);
+  parallel_for(0, counts.size(), 10, [&counts](size_t begin, size_t end) {
+    // Nested loops run inline.
+    parallel_for(begin, end, 1, [&counts](size_t nested_begin, size_t nested_end) {
+      for (size_t i = nested_begin; i < nested_end; ++i)
+        ++counts[i];
+    });
+  });
+  for (const int count : counts)
+    EXPECT_EQ(count, 1);
+  EXPECT_THROW(parallel_for(0, 100, 1, [](size_t begin, size_t) {
+    if (begin > 0)
+      throw std::runtime_error("error");
+  }), std::runtime_error);
+  set_parallel_num_threads(0);
+}
 
 class OpDeviceTest : public ::testing::TestWithParam<Device> {
 };
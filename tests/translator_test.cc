@@ -1,4 +1,6 @@
+#include <ctranslate2/autotune.h>
 #include <ctranslate2/translator.h>
+#include <ctranslate2/translator_pool.h>
 
 #include "test_utils.h"
 
@@ -149,8 +151,548 @@ TEST_P(SearchVariantTest, TranslateWithPrefix) {
   EXPECT_EQ(result.output(), expected);
 }
 
+TEST_P(SearchVariantTest, TranslateBatchWithPadding) {
+  Translator translator = default_translator();
+  TranslationOptions options;
+  options.beam_size = GetParam();
+  std::vector<std::vector<std::string>> inputs = {
+    {"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"},
+    {"آ" ,"ت" ,"ش" ,"ي" ,"س" ,"و" ,"ن"},
+    {"ي" ,"ا"}};
+  auto results = translator.translate_batch(inputs, options);
+  ASSERT_EQ(results.size(), inputs.size());
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    auto result = translator.translate(inputs[i], options);
+    EXPECT_EQ(results[i].output(), result.output());
+    EXPECT_NEAR(results[i].score(), result.score(), 1e-4);
+  }
+}
+
+TEST_P(SearchVariantTest, TranslateEncodedBatch) {
+  Translator translator = default_translator();
+  Translator decoder_translator = translator;
+  TranslationOptions options;
+  options.beam_size = GetParam();
+  std::vector<std::vector<std::string>> inputs = {
+    {"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"},
+    {"ي" ,"ا"}};
+  auto expected = translator.translate_batch(inputs, options);
+  auto results = decoder_translator.translate_encoded_batch(translator.encode_batch(inputs),
+                                                            {},
+                                                            options);
+  ASSERT_EQ(results.size(), expected.size());
+  for (size_t i = 0; i < results.size(); ++i) {
+    EXPECT_EQ(results[i].output(), expected[i].output());
+    EXPECT_NEAR(results[i].score(), expected[i].score(), 1e-4);
+  }
+}
+
+TEST_P(SearchVariantTest, TranslateBatchIds) {
+  Translator translator = default_translator();
+  const auto& source_vocab = translator.model().get_source_vocabulary();
+  const auto& target_vocab = translator.model().get_target_vocabulary();
+  TranslationOptions options;
+  options.beam_size = GetParam();
+  options.num_hypotheses = GetParam();
+  options.return_attention = true;
+  std::vector<std::vector<std::string>> inputs = {
+    {"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"},
+    {"ي" ,"ا"}};
+  std::vector<std::vector<size_t>> input_ids(inputs.size());
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    for (const auto& token : inputs[i])
+      input_ids[i].push_back(source_vocab.to_id(token));
+  }
+
+  const auto expected = translator.translate_batch(inputs, options);
+  const auto result = translator.translate_batch_ids(input_ids, options);
+  ASSERT_EQ(result.batch_size(), expected.size());
+  EXPECT_EQ(result.attention_size, 6);
+  for (size_t b = 0; b < expected.size(); ++b) {
+    ASSERT_EQ(result.hypotheses_offsets[b + 1] - result.hypotheses_offsets[b],
+              expected[b].num_hypotheses());
+    for (size_t h = 0; h < expected[b].num_hypotheses(); ++h) {
+      const size_t k = result.hypotheses_offsets[b] + h;
+      std::vector<std::string> hypothesis;
+      for (size_t i = result.offsets[k]; i < result.offsets[k + 1]; ++i)
+        hypothesis.push_back(target_vocab.to_token(result.ids[i]));
+      EXPECT_EQ(hypothesis, expected[b].hypotheses()[h]);
+      EXPECT_NEAR(result.scores[k], expected[b].scores()[h], 1e-4);
+      const auto& attention = expected[b].attention()[h];
+      ASSERT_EQ(attention.size(), hypothesis.size());
+      for (size_t t = 0; t < attention.size(); ++t)
+        EXPECT_NEAR(result.attention[(result.offsets[k] + t) * result.attention_size],
+                    attention[t][0], 1e-4);
+    }
+  }
+
+  EXPECT_THROW(translator.translate_batch_ids({{source_vocab.size()}}), std::invalid_argument);
+}
+
+TEST_P(SearchVariantTest, StreamTokens) {
+  Translator translator = default_translator();
+  std::vector<std::vector<std::string>> inputs = {
+    {"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"},
+    {"آ" ,"ت" ,"ش" ,"ي" ,"س" ,"و" ,"ن"},
+    {"ي" ,"ا"}};
+  std::vector<std::vector<std::string>> streamed(inputs.size());
+  TranslationOptions options;
+  options.beam_size = GetParam();
+  options.callback = [&streamed](size_t batch_id, const std::string& token) {
+    streamed[batch_id].push_back(token);
+  };
+  auto results = translator.translate_batch(inputs, options);
+  for (size_t i = 0; i < inputs.size(); ++i)
+    EXPECT_EQ(streamed[i], results[i].output());
+}
+
+TEST(TranslatorTest, BeamSearchAttentionFollowsBestHypothesis) {
+  Translator translator = default_translator();
+  TranslationOptions options;
+  options.return_attention = true;
+  std::vector<std::string> input = {"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"};
+  options.beam_size = 1;
+  auto greedy_result = translator.translate(input, options);
+  options.beam_size = 4;
+  auto beam_result = translator.translate(input, options);
+  ASSERT_EQ(beam_result.output(), greedy_result.output());
+  const auto& greedy_attention = greedy_result.attention()[0];
+  const auto& beam_attention = beam_result.attention()[0];
+  ASSERT_EQ(beam_attention.size(), greedy_attention.size());
+  for (size_t t = 0; t < beam_attention.size(); ++t) {
+    ASSERT_EQ(beam_attention[t].size(), greedy_attention[t].size());
+    for (size_t i = 0; i < beam_attention[t].size(); ++i)
+      EXPECT_NEAR(beam_attention[t][i], greedy_attention[t][i], 1e-4);
+  }
+}
+
+TEST_P(SearchVariantTest, TranslateWithEncoderCache) {
+  TranslationOptions options;
+  options.beam_size = GetParam();
+  std::vector<std::string> input = {"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"};
+  std::vector<std::vector<std::string>> prefixes = {{}, {"a"}, {"a", "t"}, {"a", "t", "z"}};
+  Translator translator = default_translator();
+  Translator cached_translator = default_translator();
+  auto cache = std::make_shared<EncoderCache>(1 << 20);
+  cached_translator.set_encoder_cache(cache);
+  for (const auto& prefix : prefixes) {
+    auto expected = translator.translate_with_prefix(input, prefix, options);
+    auto result = cached_translator.translate_with_prefix(input, prefix, options);
+    EXPECT_EQ(result.output(), expected.output());
+    EXPECT_NEAR(result.score(), expected.score(), 1e-4);
+  }
+  EXPECT_EQ(cache->misses(), 1);
+  EXPECT_EQ(cache->hits(), prefixes.size() - 1);
+}
+
+TEST_P(SearchVariantTest, TranslateWithSession) {
+  TranslationOptions options;
+  options.beam_size = GetParam();
+  std::vector<std::string> input = {"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"};
+  std::vector<std::vector<std::string>> prefixes = {
+    {"a"}, {"a", "t"}, {"a", "t", "z"}, {"a", "t"}, {"a", "t", "z", "m"},
+    {"a", "t", "z", "m"}};
+  Translator translator = default_translator();
+  TranslationSession session;
+  for (const auto& prefix : prefixes) {
+    auto expected = translator.translate_with_prefix(input, prefix, options);
+    auto result = translator.translate_with_prefix(input, prefix, options, session);
+    EXPECT_EQ(result.output(), expected.output());
+    EXPECT_NEAR(result.score(), expected.score(), 1e-4);
+  }
+}
+
+TEST(TranslatorTest, GreedySearchWithoutScores) {
+  Translator translator = default_translator();
+  TranslationOptions options;
+  options.beam_size = 1;
+  std::vector<std::string> input = {"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"};
+  auto result = translator.translate(input, options);
+  EXPECT_LT(result.score(), 0);
+  options.return_scores = false;
+  auto result_without_scores = translator.translate(input, options);
+  EXPECT_EQ(result_without_scores.output(), result.output());
+  EXPECT_EQ(result_without_scores.score(), 0);
+}
+
 INSTANTIATE_TEST_CASE_P(
   TranslatorTest,
   SearchVariantTest,
   ::testing::Values(1, 4),
   beam_to_test_name);
+
+TEST(TranslatorTest, TranslateWithClonedModel) {
+  Translator translator = default_translator();
+  Translator cloned_translator(translator.model().clone());
+  std::vector<std::string> input = {"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"};
+  auto expected = translator.translate(input);
+  auto result = cloned_translator.translate(input);
+  EXPECT_EQ(result.output(), expected.output());
+  EXPECT_EQ(result.score(), expected.score());
+}
+
+TEST(TranslatorPoolTest, PostFromMultipleThreads) {
+  TranslatorPool pool(2, 1, g_data_dir + "/models/v2/aren-transliteration", Device::CPU);
+  const TranslationInput input = {{"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"}};
+  const std::vector<std::string> expected = {"a", "t", "z", "m", "o", "n"};
+
+  std::vector<std::thread> threads;
+  std::vector<std::vector<std::future<TranslationOutput>>> futures(4);
+  for (auto& thread_futures : futures) {
+    threads.emplace_back([&pool, &input, &thread_futures]() {
+      for (size_t i = 0; i < 8; ++i)
+        thread_futures.emplace_back(pool.post(input, TranslationOptions()));
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+
+  for (auto& thread_futures : futures) {
+    for (auto& future : thread_futures) {
+      auto output = future.get();
+      ASSERT_EQ(output.size(), 1);
+      EXPECT_EQ(output[0].output(), expected);
+    }
+  }
+}
+
+TEST(TranslatorPoolTest, MergeQueuedJobs) {
+  const std::string model_path = g_data_dir + "/models/v2/aren-transliteration";
+  const TranslationInput inputs = {
+    {"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"},
+    {"آ" ,"ت" ,"ش" ,"ي" ,"س" ,"و" ,"ن"},
+    {"ي" ,"ا"}};
+  Translator translator(model_path, Device::CPU);
+  const auto expected = translator.translate_batch(inputs);
+
+  TranslatorPool pool(1, 1, model_path, Device::CPU);
+  BatchingOptions batching_options;
+  batching_options.max_batch_size = 16;
+  batching_options.max_wait = std::chrono::milliseconds(10);
+  pool.set_batching_options(batching_options);
+
+  std::vector<std::future<TranslationOutput>> futures;
+  for (size_t i = 0; i < 12; ++i)
+    futures.emplace_back(pool.post(TranslationInput(1, inputs[i % inputs.size()]),
+                                   TranslationOptions()));
+  for (size_t i = 0; i < futures.size(); ++i) {
+    auto output = futures[i].get();
+    ASSERT_EQ(output.size(), 1);
+    EXPECT_EQ(output[0].output(), expected[i % inputs.size()].output());
+  }
+}
+
+TEST(TranslatorPoolTest, MergingWorkerDoesNotDelayOtherJobs) {
+  TranslatorPool pool(2, 1, g_data_dir + "/models/v2/aren-transliteration", Device::CPU);
+  BatchingOptions batching_options;
+  batching_options.max_batch_size = 16;
+  batching_options.max_wait = std::chrono::seconds(3);
+  pool.set_batching_options(batching_options);
+
+  const TranslationInput input = {{"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"}};
+  auto merged = pool.post(input, TranslationOptions());
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  // A job that can not be merged (prefixed translation) should be run by the idle worker.
+  const auto start = std::chrono::steady_clock::now();
+  pool.post(input, {{"a"}}, TranslationOptions()).get();
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(2));
+  merged.get();
+}
+
+TEST(TranslatorPoolTest, FailExpiredJobs) {
+  TranslatorPool pool(1, 1, g_data_dir + "/models/v2/aren-transliteration", Device::CPU);
+  const TranslationInput input = {{"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"}};
+  JobOptions job_options;
+  job_options.priority = JobPriority::High;
+  job_options.deadline = std::chrono::steady_clock::now() - std::chrono::seconds(1);
+  auto expired = pool.post(input, TranslationInput(), TranslationOptions(), job_options);
+  auto valid = pool.post(input, TranslationInput(), TranslationOptions(), JobOptions());
+  EXPECT_THROW(expired.get(), std::runtime_error);
+  EXPECT_EQ(valid.get()[0].output().size(), 6);
+}
+
+TEST(TranslatorPoolTest, RejectInvalidPriority) {
+  TranslatorPool pool(1, 1, g_data_dir + "/models/v2/aren-transliteration", Device::CPU);
+  JobOptions job_options;
+  job_options.priority = static_cast<JobPriority>(num_job_priorities);
+  EXPECT_THROW(pool.post({{"آ"}}, TranslationInput(), TranslationOptions(), job_options),
+               std::invalid_argument);
+}
+
+TEST(TranslatorPoolTest, CancelJobs) {
+  TranslatorPool pool(1, 1, g_data_dir + "/models/v2/aren-transliteration", Device::CPU);
+  const TranslationInput input = {{"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"}};
+  TranslationOptions long_options;
+  long_options.max_decoding_length = 100000;
+  long_options.min_decoding_length = 100000;
+  auto running = pool.post_cancellable(input, TranslationInput(), long_options);
+  auto queued = pool.post_cancellable(input, TranslationInput(), TranslationOptions());
+  queued.cancel();
+  EXPECT_THROW(queued.future().get(), std::runtime_error);
+  running.cancel();
+  EXPECT_THROW(running.future().get(), std::runtime_error);
+  EXPECT_EQ(pool.post(input, TranslationOptions()).get()[0].output().size(), 6);
+}
+
+TEST(TranslatorPoolTest, ConsumeStreamWithBoundedWindow) {
+  TranslatorPool pool(2, 1, g_data_dir + "/models/v2/aren-transliteration", Device::CPU);
+  const size_t max_batch_size = 2;
+  const size_t max_inflight_batches = 1;
+  std::istringstream in(std::string(10, '\n'));
+  std::ostringstream out;
+  size_t num_read = 0;
+  std::atomic<size_t> num_written(0);  // The writer is called from another thread.
+
+  auto reader = [&](std::istream& in, std::vector<std::string>& tokens) {
+    std::string line;
+    if (!std::getline(in, line))
+      return false;
+    tokens = {"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"};
+    ++num_read;
+    // One batch can be in flight and another one is being filled.
+    EXPECT_LE(num_read - num_written.load(), (max_inflight_batches + 1) * max_batch_size);
+    return true;
+  };
+  auto writer = [&](std::ostream&, const TranslationResult& result) {
+    EXPECT_EQ(result.output().size(), 6);
+    ++num_written;
+  };
+
+  pool.consume_stream(in, out, max_batch_size, TranslationOptions(), reader, writer,
+                      max_inflight_batches);
+  EXPECT_EQ(num_read, 10);
+  EXPECT_EQ(num_written, 10);
+}
+
+TEST(TranslatorPoolTest, PostWithCallback) {
+  TranslatorPool pool(2, 1, g_data_dir + "/models/v2/aren-transliteration", Device::CPU);
+  const TranslationInput input = {{"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"}};
+  const std::vector<std::string> expected = {"a", "t", "z", "m", "o", "n"};
+
+  // Callbacks are queued and run by the test thread.
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::queue<std::function<void()>> callbacks;
+  pool.set_callback_executor([&](std::function<void()> callback) {
+    std::lock_guard<std::mutex> lock(mutex);
+    callbacks.emplace(std::move(callback));
+    cv.notify_one();
+  });
+
+  const size_t num_jobs = 8;
+  size_t num_completed = 0;
+  JobOptions expired_options;
+  expired_options.deadline = std::chrono::steady_clock::now() - std::chrono::seconds(1);
+  pool.post(input, TranslationInput(), TranslationOptions(), expired_options,
+            [](std::exception_ptr error, TranslationOutput output) {
+              EXPECT_TRUE(error != nullptr);
+              EXPECT_TRUE(output.empty());
+            });
+  for (size_t i = 0; i < num_jobs; ++i) {
+    pool.post(input, TranslationInput(), TranslationOptions(), JobOptions(),
+              [&](std::exception_ptr error, TranslationOutput output) {
+                EXPECT_TRUE(error == nullptr);
+                ASSERT_EQ(output.size(), 1);
+                EXPECT_EQ(output[0].output(), expected);
+                ++num_completed;
+              });
+  }
+
+  for (size_t i = 0; i < num_jobs + 1; ++i) {
+    std::function<void()> callback;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&callbacks]{ return !callbacks.empty(); });
+      callback = std::move(callbacks.front());
+      callbacks.pop();
+    }
+    callback();
+  }
+  EXPECT_EQ(num_completed, num_jobs);
+}
+
+TEST(TranslatorPoolTest, CallbackExecutorThrows) {
+  TranslatorPool pool(1, 1, g_data_dir + "/models/v2/aren-transliteration", Device::CPU);
+  pool.set_callback_executor([](std::function<void()>) {
+    throw std::runtime_error("executor is full");
+  });
+  std::promise<std::exception_ptr> completed;
+  pool.post({{"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"}}, TranslationInput(), TranslationOptions(),
+            JobOptions(),
+            [&completed](std::exception_ptr error, TranslationOutput output) {
+              EXPECT_TRUE(output.empty());
+              completed.set_value(error);
+            });
+  EXPECT_THROW(std::rethrow_exception(completed.get_future().get()), std::runtime_error);
+}
+
+TEST(TranslatorPoolTest, DestroyWithPendingCallbacks) {
+  const TranslationInput input = {{"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"}};
+  const size_t num_jobs = 50;
+  std::atomic<size_t> num_completed(0);
+  {
+    TranslatorPool pool(1, 1, g_data_dir + "/models/v2/aren-transliteration", Device::CPU);
+    for (size_t i = 0; i < num_jobs; ++i) {
+      pool.post(input, TranslationInput(), TranslationOptions(), JobOptions(),
+                [&](std::exception_ptr, TranslationOutput) { ++num_completed; });
+    }
+  }
+  // Jobs that were not run are completed with an error.
+  EXPECT_EQ(num_completed, num_jobs);
+}
+
+TEST(TranslatorPoolTest, ConsumeStreamWithBatchCallback) {
+  TranslatorPool pool(2, 1, g_data_dir + "/models/v2/aren-transliteration", Device::CPU);
+  std::istringstream in(std::string(7, '\n'));
+  auto reader = [](std::istream& in, std::vector<std::string>& tokens) {
+    std::string line;
+    if (!std::getline(in, line))
+      return false;
+    tokens = {"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"};
+    return true;
+  };
+
+  std::mutex mutex;
+  std::vector<size_t> batch_sizes(4, 0);
+  auto on_batch = [&](size_t batch_index, TranslationOutput output) {
+    std::lock_guard<std::mutex> lock(mutex);
+    batch_sizes.at(batch_index) = output.size();
+  };
+
+  const size_t num_batches = pool.consume_stream(in, 2, TranslationOptions(), reader, on_batch);
+  EXPECT_EQ(num_batches, 4);
+  EXPECT_EQ(batch_sizes, (std::vector<size_t>{2, 2, 2, 1}));
+
+  std::istringstream failing_in(std::string(7, '\n'));
+  auto failing_callback = [](size_t, TranslationOutput) {
+    throw std::runtime_error("batch callback failed");
+  };
+  EXPECT_THROW(pool.consume_stream(failing_in, 2, TranslationOptions(), reader,
+                                   failing_callback),
+               std::runtime_error);
+}
+
+TEST(TranslatorPoolTest, TranslateBatchIds) {
+  TranslatorPool pool(2, 1, g_data_dir + "/models/v2/aren-transliteration", Device::CPU);
+  Translator translator(g_data_dir + "/models/v2/aren-transliteration", Device::CPU);
+  const auto& source_vocab = translator.model().get_source_vocabulary();
+  std::vector<size_t> input_ids;
+  for (const auto& token : {"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"})
+    input_ids.push_back(source_vocab.to_id(token));
+  const auto expected = translator.translate_batch_ids({input_ids});
+
+  BatchingOptions batching_options;
+  batching_options.max_batch_size = 16;
+  pool.set_batching_options(batching_options);
+  pool.set_cache(1 << 20);
+  std::vector<std::future<TranslationIdsResult>> futures;
+  for (size_t i = 0; i < 4; ++i)
+    futures.emplace_back(pool.translate_batch_ids({input_ids}, TranslationOptions()));
+  for (auto& future : futures) {
+    const auto result = future.get();
+    EXPECT_EQ(result.ids, expected.ids);
+    EXPECT_EQ(result.offsets, expected.offsets);
+  }
+
+  JobOptions job_options;
+  job_options.deadline = std::chrono::steady_clock::now() - std::chrono::seconds(1);
+  auto expired = pool.translate_batch_ids({input_ids}, TranslationOptions(), job_options);
+  EXPECT_THROW(expired.get(), std::runtime_error);
+}
+
+TEST(TranslatorPoolTest, ConsumeTextFile) {
+  TranslatorPool pool(2, 1, g_data_dir + "/models/v2/aren-transliteration", Device::CPU);
+  std::istringstream in("آ ت ز م و ن\n  آ  ت ز م و ن \nآ ت ز م و ن\n");
+  std::ostringstream out;
+  const size_t num_tokens = pool.consume_text_file(in, out, 2, TranslationOptions());
+  EXPECT_EQ(out.str(), "a t z m o n\na t z m o n\na t z m o n\n");
+  EXPECT_EQ(num_tokens, 18);
+}
+
+TEST(TranslatorPoolTest, CacheResults) {
+  const std::string model_path = g_data_dir + "/models/v2/aren-transliteration";
+  const TranslationInput inputs = {
+    {"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"},
+    {"ي" ,"ا"},
+    {"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"}};
+  Translator translator(model_path, Device::CPU);
+  const auto expected = translator.translate_batch(inputs);
+
+  TranslatorPool pool(1, 1, model_path, Device::CPU);
+  pool.set_cache(1 << 20);
+  for (size_t run = 0; run < 2; ++run) {
+    auto output = pool.post(inputs, TranslationOptions()).get();
+    ASSERT_EQ(output.size(), inputs.size());
+    for (size_t i = 0; i < inputs.size(); ++i)
+      EXPECT_EQ(output[i].output(), expected[i].output());
+  }
+
+  // return_scores is ignored by beam search so these examples are also cached.
+  TranslationOptions options;
+  options.return_scores = false;
+  pool.post(inputs, options).get();
+
+  const auto* cache = pool.cache();
+  ASSERT_NE(cache, nullptr);
+  EXPECT_EQ(cache->misses(), 3);
+  EXPECT_EQ(cache->hits(), 6);
+  EXPECT_GT(cache->memory_usage(), 0);
+}
+
+TEST(TranslatorPoolTest, PlaceReplicasOnNumaNodes) {
+  PlacementOptions placement;
+  placement.numa_aware = true;
+  placement.replicate_weights = true;
+  placement.pin_threads = true;
+  TranslatorPool pool(placement, 2, 1, g_data_dir + "/models/v2/aren-transliteration", Device::CPU);
+  const TranslationInput input = {{"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"}};
+  const std::vector<std::string> expected = {"a", "t", "z", "m", "o", "n"};
+  std::vector<std::future<TranslationOutput>> futures;
+  for (size_t i = 0; i < 4; ++i)
+    futures.emplace_back(pool.post(input, TranslationOptions()));
+  for (auto& future : futures)
+    EXPECT_EQ(future.get()[0].output(), expected);
+}
+
+TEST(TranslatorPoolTest, AutotuneThreads) {
+  auto model = models::Model::load(g_data_dir + "/models/v2/aren-transliteration", Device::CPU);
+  AutotuneOptions options;
+  options.num_cores = 2;
+  options.batch_sizes = {1, 4};
+  options.sentence_length = 5;
+  options.num_batches_per_replica = 1;
+  const auto result = autotune_threads(model, options);
+  ASSERT_EQ(result.configs.size(), 4);  // (1, 2) and (2, 1) for each batch size.
+  for (const auto& config : result.configs) {
+    EXPECT_EQ(config.inter_threads * config.intra_threads, 2);
+    EXPECT_GT(config.tokens_per_second, 0);
+  }
+  for (const auto& config : result.configs)
+    EXPECT_LE(config.tokens_per_second, result.best.tokens_per_second);
+}
+
+TEST(TranslatorPoolTest, PipelineEncoderAndDecoder) {
+  TranslatorPool pool(2, 1, g_data_dir + "/models/v2/aren-transliteration", Device::CPU);
+  PipelineOptions pipeline_options;
+  pipeline_options.num_encoder_workers = 1;
+  pipeline_options.num_threads_per_encoder = 1;
+  pipeline_options.max_queued_batches = 1;
+  pool.set_pipeline_options(pipeline_options);
+
+  const TranslationInput input = {{"آ" ,"ت" ,"ز" ,"م" ,"و" ,"ن"}, {"آ" ,"ت" ,"ش" ,"ي" ,"س" ,"و" ,"ن"}};
+  const TranslationInput target_prefix = {{"a", "t", "z"}};
+  const auto expected = Translator(g_data_dir + "/models/v2/aren-transliteration",
+                                   Device::CPU).translate_batch(input);
+  std::vector<std::future<TranslationOutput>> futures;
+  for (size_t i = 0; i < 8; ++i)
+    futures.emplace_back(pool.post(input, TranslationOptions()));
+  auto prefix_future = pool.post({input[0]}, target_prefix, TranslationOptions());
+  for (auto& future : futures) {
+    const auto output = future.get();
+    ASSERT_EQ(output.size(), expected.size());
+    for (size_t i = 0; i < output.size(); ++i)
+      EXPECT_EQ(output[i].output(), expected[i].output());
+  }
+  EXPECT_EQ(prefix_future.get()[0].output(), expected[0].output());
+}